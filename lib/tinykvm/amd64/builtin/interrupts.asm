@@ -30,7 +30,8 @@ dw .vm64_except1 - .vm64_exception
 dw .vm64_dso
 .vm64_remote_return_addr:
 	dw 0x0   ;; Return address after remote call
-dd 0x0       ;; Reserved/Padding
+dw .vm64_syscall_nofast
+dw .vm64_fastpath_table
 
 ALIGN 0x10
 .kvm_wallclock:   ;; 0x2010
@@ -38,8 +39,17 @@ ALIGN 0x10
 .kvm_system_time: ;; 0x2020
 	resb 0x20     ;; 32b for KVM System-time
 
+;; System calls answered in the guest, installed by the host.
+;; 24 entries of: u32 syscall, u16 kind, u16 reserved, i64 value
+;; A zero kind ends the table, and the 25th entry is always zero.
+.vm64_fastpath_table: ;; 0x2040
+	resb 25 * 16
+
 ALIGN 0x10
 .vm64_syscall:
+	cmp WORD [rel .vm64_fastpath_table + 4], 0
+	jne .vm64_fastpath
+.vm64_syscall_nofast:
 	cmp eax, 158 ;; PRCTL
 	je .vm64_prctl
 	cmp eax, 228 ;; CLOCK_GETTIME
@@ -224,6 +234,109 @@ ALIGN 0x10
 .vm64_mmap_done:
 	o64 sysret
 
+.vm64_fastpath:
+	stac
+	push rbx
+	lea rbx, [rel .vm64_fastpath_table]
+.vm64_fastpath_next:
+	cmp eax, DWORD [rbx]
+	je .vm64_fastpath_hit
+	add rbx, 16
+	cmp WORD [rbx + 4], 0
+	jne .vm64_fastpath_next
+	;; Not in the table
+	pop rbx
+	clac
+	jmp .vm64_syscall_nofast
+.vm64_fastpath_hit:
+	cmp WORD [rbx + 4], 2 ;; SIGPROCMASK
+	je .vm64_fastpath_sigprocmask
+	cmp WORD [rbx + 4], 3 ;; TIME
+	je .vm64_fastpath_time
+	cmp WORD [rbx + 4], 4 ;; GETTIMEOFDAY
+	je .vm64_fastpath_gettimeofday
+.vm64_fastpath_value:
+	;; RESULT: Return the value
+	mov rax, [rbx + 8]
+.vm64_fastpath_done:
+	pop rbx
+	clac
+	o64 sysret
+.vm64_fastpath_miss:
+	;; The pointer is outside of guest memory,
+	;; so the host answers like it always does
+	mov eax, DWORD [rbx]
+	pop rbx
+	clac
+	jmp .vm64_syscall_nofast
+
+;; The value of pointer-writing entries is the end of guest memory
+%macro fastpath_check_ptr 2
+	cmp %1, 0x100000
+	jb .vm64_fastpath_miss
+	mov rax, %1
+	add rax, %2
+	jc .vm64_fastpath_miss
+	cmp rax, [rbx + 8]
+	ja .vm64_fastpath_miss
+%endmacro
+
+.vm64_fastpath_sigprocmask:
+	;; rdx = oldset, all signals blocked
+	xor eax, eax
+	test rdx, rdx
+	jz .vm64_fastpath_done
+	fastpath_check_ptr rdx, 8
+	mov QWORD [rdx], -1
+	xor eax, eax
+	jmp .vm64_fastpath_done
+
+.vm64_fastpath_time:
+	;; rdi = optional time_t
+	test rdi, rdi
+	jz .vm64_fastpath_time_now
+	fastpath_check_ptr rdi, 8
+.vm64_fastpath_time_now:
+	push rcx
+	push rdx
+	call .read_system_time
+	call .read_wall_clock
+	xor rdx, rdx
+	mov rbx, 1000000000   ;; 1e9
+	div rbx               ;; rax = seconds
+	add rax, rcx          ;; Add wall-clock seconds
+	pop rdx
+	pop rcx
+	test rdi, rdi
+	jz .vm64_fastpath_done
+	mov [rdi], rax        ;; Store time_t
+	jmp .vm64_fastpath_done
+
+.vm64_fastpath_gettimeofday:
+	;; rdi = timeval, rsi = timezone (ignored)
+	xor eax, eax
+	test rdi, rdi
+	jz .vm64_fastpath_done
+	fastpath_check_ptr rdi, 16
+	push rcx
+	push rdx
+	call .read_system_time
+	call .read_wall_clock
+	xor rdx, rdx
+	mov rbx, 1000000000   ;; 1e9
+	div rbx               ;; rax = seconds, rdx = nanoseconds
+	add rax, rcx          ;; Add wall-clock seconds
+	mov [rdi], rax        ;; Store tv_sec
+	mov rax, rdx
+	xor rdx, rdx
+	mov rbx, 1000
+	div rbx               ;; rax = microseconds
+	mov [rdi + 8], rax    ;; Store tv_usec
+	xor eax, eax
+	pop rdx
+	pop rcx
+	jmp .vm64_fastpath_done
+
 .vm64_gettimeofday:
 	mov eax, 96 ;; gettimeofday
 	out 0, eax
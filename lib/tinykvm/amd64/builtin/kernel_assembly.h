@@ -1,63 +1,123 @@
 unsigned char interrupts[] = {
-  0x40, 0x00, 0xb3, 0x01, 0x20, 0x02, 0x08, 0x00, 0xbb, 0x01, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x3d, 0x9e, 0x00, 0x00, 0x00, 0x74, 0x3a, 0x3d,
-  0xe4, 0x00, 0x00, 0x00, 0x0f, 0x84, 0xed, 0x00, 0x00, 0x00, 0x83, 0xf8,
-  0x09, 0x0f, 0x84, 0x3f, 0x01, 0x00, 0x00, 0x3d, 0x77, 0xf7, 0x01, 0x00,
-  0x0f, 0x84, 0x6b, 0x01, 0x00, 0x00, 0x3d, 0x78, 0xf7, 0x01, 0x00, 0x0f,
-  0x84, 0x50, 0x01, 0x00, 0x00, 0x3d, 0x07, 0xf7, 0x01, 0x00, 0x0f, 0x84,
-  0x5e, 0x01, 0x00, 0x00, 0xe7, 0x00, 0x48, 0x0f, 0x07, 0x0f, 0x01, 0xcb,
-  0x56, 0x51, 0x52, 0x48, 0x81, 0xff, 0x02, 0x10, 0x00, 0x00, 0x75, 0x1b,
-  0xb9, 0x00, 0x01, 0x00, 0xc0, 0x89, 0xf0, 0x48, 0xc1, 0xee, 0x20, 0x89,
-  0xf2, 0x0f, 0x30, 0x48, 0x31, 0xc0, 0x5a, 0x59, 0x5e, 0x0f, 0x01, 0xca,
-  0x48, 0x0f, 0x07, 0x48, 0x81, 0xff, 0x03, 0x10, 0x00, 0x00, 0x75, 0x16,
-  0xb9, 0x00, 0x01, 0x00, 0xc0, 0x0f, 0x32, 0x48, 0xc1, 0xe2, 0x20, 0x48,
-  0x09, 0xc2, 0x48, 0x89, 0x06, 0x48, 0x31, 0xc0, 0xeb, 0xd8, 0xe7, 0x00,
-  0xeb, 0xd4, 0x0f, 0x31, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0, 0x48,
-  0x2b, 0x05, 0x4a, 0xff, 0xff, 0xff, 0x8a, 0x0d, 0x58, 0xff, 0xff, 0xff,
-  0x84, 0xc9, 0x78, 0x05, 0x48, 0xd3, 0xe0, 0xeb, 0x05, 0xf7, 0xd9, 0x48,
-  0xd3, 0xe8, 0x8b, 0x0d, 0x40, 0xff, 0xff, 0xff, 0x48, 0xf7, 0xe1, 0x48,
-  0xc1, 0xe8, 0x20, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0, 0x48, 0x03,
-  0x05, 0x23, 0xff, 0xff, 0xff, 0xc3, 0x8b, 0x0d, 0x00, 0xff, 0xff, 0xff,
-  0x85, 0xc9, 0x75, 0x17, 0xb9, 0x00, 0x4d, 0x56, 0x4b, 0x48, 0x8d, 0x05,
-  0xec, 0xfe, 0xff, 0xff, 0x48, 0x89, 0xc2, 0x48, 0xc1, 0xea, 0x20, 0x89,
-  0xc0, 0x0f, 0x30, 0x8b, 0x0d, 0xdf, 0xfe, 0xff, 0xff, 0x8b, 0x15, 0xdd,
-  0xfe, 0xff, 0xff, 0x48, 0x01, 0xd0, 0xc3, 0x0f, 0x01, 0xcb, 0x53, 0x51,
-  0x52, 0x48, 0x81, 0xfe, 0x00, 0x00, 0x10, 0x00, 0x72, 0x32, 0xe8, 0x7b,
-  0xff, 0xff, 0xff, 0x48, 0x31, 0xc9, 0x48, 0x85, 0xff, 0x75, 0x05, 0xe8,
-  0xae, 0xff, 0xff, 0xff, 0x48, 0x31, 0xd2, 0xbb, 0x00, 0xca, 0x9a, 0x3b,
-  0x48, 0xf7, 0xf3, 0x48, 0x01, 0xc8, 0x48, 0x89, 0x06, 0x48, 0x89, 0x56,
-  0x08, 0x5a, 0x59, 0x5b, 0x0f, 0x01, 0xca, 0x31, 0xc0, 0x48, 0x0f, 0x07,
-  0x48, 0xc7, 0xc0, 0xf2, 0xff, 0xff, 0xff, 0x48, 0x0f, 0x07, 0x5a, 0x59,
-  0x5b, 0x0f, 0x01, 0xca, 0xb8, 0xe4, 0x00, 0x00, 0x00, 0xe7, 0x00, 0x48,
-  0x0f, 0x07, 0xe7, 0x00, 0x49, 0x83, 0xf8, 0xff, 0x74, 0x0e, 0x0f, 0x01,
-  0xcb, 0x50, 0x0f, 0x20, 0xd8, 0x0f, 0x22, 0xd8, 0x58, 0x0f, 0x01, 0xca,
-  0x48, 0x0f, 0x07, 0xb8, 0x60, 0x00, 0x00, 0x00, 0xe7, 0x00, 0xc3, 0xb8,
-  0xb3, 0x01, 0x00, 0x00, 0xc3, 0xe7, 0x00, 0xf3, 0x48, 0x0f, 0xae, 0xd0,
+  0xd0, 0x01, 0x77, 0x04, 0xe8, 0x04, 0x08, 0x00, 0x7f, 0x04, 0x00, 0x00,
+  0xde, 0x01, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x66, 0x83, 0x3d, 0x6c,
+  0xfe, 0xff, 0xff, 0x00, 0x0f, 0x85, 0x73, 0x01, 0x00, 0x00, 0x3d, 0x9e,
+  0x00, 0x00, 0x00, 0x74, 0x3a, 0x3d, 0xe4, 0x00, 0x00, 0x00, 0x0f, 0x84,
+  0xed, 0x00, 0x00, 0x00, 0x83, 0xf8, 0x09, 0x0f, 0x84, 0x3f, 0x01, 0x00,
+  0x00, 0x3d, 0x77, 0xf7, 0x01, 0x00, 0x0f, 0x84, 0x91, 0x02, 0x00, 0x00,
+  0x3d, 0x78, 0xf7, 0x01, 0x00, 0x0f, 0x84, 0x76, 0x02, 0x00, 0x00, 0x3d,
+  0x07, 0xf7, 0x01, 0x00, 0x0f, 0x84, 0x84, 0x02, 0x00, 0x00, 0xe7, 0x00,
+  0x48, 0x0f, 0x07, 0x0f, 0x01, 0xcb, 0x56, 0x51, 0x52, 0x48, 0x81, 0xff,
+  0x02, 0x10, 0x00, 0x00, 0x75, 0x1b, 0xb9, 0x00, 0x01, 0x00, 0xc0, 0x89,
+  0xf0, 0x48, 0xc1, 0xee, 0x20, 0x89, 0xf2, 0x0f, 0x30, 0x48, 0x31, 0xc0,
+  0x5a, 0x59, 0x5e, 0x0f, 0x01, 0xca, 0x48, 0x0f, 0x07, 0x48, 0x81, 0xff,
+  0x03, 0x10, 0x00, 0x00, 0x75, 0x16, 0xb9, 0x00, 0x01, 0x00, 0xc0, 0x0f,
+  0x32, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xc2, 0x48, 0x89, 0x06, 0x48,
+  0x31, 0xc0, 0xeb, 0xd8, 0xe7, 0x00, 0xeb, 0xd4, 0x0f, 0x31, 0x48, 0xc1,
+  0xe2, 0x20, 0x48, 0x09, 0xd0, 0x48, 0x2b, 0x05, 0xac, 0xfd, 0xff, 0xff,
+  0x8a, 0x0d, 0xba, 0xfd, 0xff, 0xff, 0x84, 0xc9, 0x78, 0x05, 0x48, 0xd3,
+  0xe0, 0xeb, 0x05, 0xf7, 0xd9, 0x48, 0xd3, 0xe8, 0x8b, 0x0d, 0xa2, 0xfd,
+  0xff, 0xff, 0x48, 0xf7, 0xe1, 0x48, 0xc1, 0xe8, 0x20, 0x48, 0xc1, 0xe2,
+  0x20, 0x48, 0x09, 0xd0, 0x48, 0x03, 0x05, 0x85, 0xfd, 0xff, 0xff, 0xc3,
+  0x8b, 0x0d, 0x62, 0xfd, 0xff, 0xff, 0x85, 0xc9, 0x75, 0x17, 0xb9, 0x00,
+  0x4d, 0x56, 0x4b, 0x48, 0x8d, 0x05, 0x4e, 0xfd, 0xff, 0xff, 0x48, 0x89,
+  0xc2, 0x48, 0xc1, 0xea, 0x20, 0x89, 0xc0, 0x0f, 0x30, 0x8b, 0x0d, 0x41,
+  0xfd, 0xff, 0xff, 0x8b, 0x15, 0x3f, 0xfd, 0xff, 0xff, 0x48, 0x01, 0xd0,
+  0xc3, 0x0f, 0x01, 0xcb, 0x53, 0x51, 0x52, 0x48, 0x81, 0xfe, 0x00, 0x00,
+  0x10, 0x00, 0x72, 0x32, 0xe8, 0x7b, 0xff, 0xff, 0xff, 0x48, 0x31, 0xc9,
+  0x48, 0x85, 0xff, 0x75, 0x05, 0xe8, 0xae, 0xff, 0xff, 0xff, 0x48, 0x31,
+  0xd2, 0xbb, 0x00, 0xca, 0x9a, 0x3b, 0x48, 0xf7, 0xf3, 0x48, 0x01, 0xc8,
+  0x48, 0x89, 0x06, 0x48, 0x89, 0x56, 0x08, 0x5a, 0x59, 0x5b, 0x0f, 0x01,
+  0xca, 0x31, 0xc0, 0x48, 0x0f, 0x07, 0x48, 0xc7, 0xc0, 0xf2, 0xff, 0xff,
+  0xff, 0x48, 0x0f, 0x07, 0x5a, 0x59, 0x5b, 0x0f, 0x01, 0xca, 0xb8, 0xe4,
+  0x00, 0x00, 0x00, 0xe7, 0x00, 0x48, 0x0f, 0x07, 0xe7, 0x00, 0x49, 0x83,
+  0xf8, 0xff, 0x74, 0x0e, 0x0f, 0x01, 0xcb, 0x50, 0x0f, 0x20, 0xd8, 0x0f,
+  0x22, 0xd8, 0x58, 0x0f, 0x01, 0xca, 0x48, 0x0f, 0x07, 0x0f, 0x01, 0xcb,
+  0x53, 0x48, 0x8d, 0x1d, 0xe4, 0xfc, 0xff, 0xff, 0x3b, 0x03, 0x74, 0x14,
+  0x48, 0x83, 0xc3, 0x10, 0x66, 0x83, 0x7b, 0x04, 0x00, 0x75, 0xf1, 0x5b,
+  0x0f, 0x01, 0xca, 0xe9, 0x6a, 0xfe, 0xff, 0xff, 0x66, 0x83, 0x7b, 0x04,
+  0x02, 0x74, 0x28, 0x66, 0x83, 0x7b, 0x04, 0x03, 0x74, 0x4b, 0x66, 0x83,
+  0x7b, 0x04, 0x04, 0x0f, 0x84, 0x83, 0x00, 0x00, 0x00, 0x48, 0x8b, 0x43,
+  0x08, 0x5b, 0x0f, 0x01, 0xca, 0x48, 0x0f, 0x07, 0x8b, 0x03, 0x5b, 0x0f,
+  0x01, 0xca, 0xe9, 0x3b, 0xfe, 0xff, 0xff, 0x31, 0xc0, 0x48, 0x85, 0xd2,
+  0x74, 0xe7, 0x48, 0x81, 0xfa, 0x00, 0x00, 0x10, 0x00, 0x72, 0xe5, 0x48,
+  0x89, 0xd0, 0x48, 0x83, 0xc0, 0x08, 0x72, 0xdc, 0x48, 0x3b, 0x43, 0x08,
+  0x77, 0xd6, 0x48, 0xc7, 0x02, 0xff, 0xff, 0xff, 0xff, 0x31, 0xc0, 0xeb,
+  0xc4, 0x48, 0x85, 0xff, 0x74, 0x18, 0x48, 0x81, 0xff, 0x00, 0x00, 0x10,
+  0x00, 0x72, 0xbd, 0x48, 0x89, 0xf8, 0x48, 0x83, 0xc0, 0x08, 0x72, 0xb4,
+  0x48, 0x3b, 0x43, 0x08, 0x77, 0xae, 0x51, 0x52, 0xe8, 0x7b, 0xfe, 0xff,
+  0xff, 0xe8, 0xb6, 0xfe, 0xff, 0xff, 0x48, 0x31, 0xd2, 0xbb, 0x00, 0xca,
+  0x9a, 0x3b, 0x48, 0xf7, 0xf3, 0x48, 0x01, 0xc8, 0x5a, 0x59, 0x48, 0x85,
+  0xff, 0x74, 0x86, 0x48, 0x89, 0x07, 0xeb, 0x81, 0x31, 0xc0, 0x48, 0x85,
+  0xff, 0x0f, 0x84, 0x76, 0xff, 0xff, 0xff, 0x48, 0x81, 0xff, 0x00, 0x00,
+  0x10, 0x00, 0x0f, 0x82, 0x70, 0xff, 0xff, 0xff, 0x48, 0x89, 0xf8, 0x48,
+  0x83, 0xc0, 0x10, 0x0f, 0x82, 0x63, 0xff, 0xff, 0xff, 0x48, 0x3b, 0x43,
+  0x08, 0x0f, 0x87, 0x59, 0xff, 0xff, 0xff, 0x51, 0x52, 0xe8, 0x26, 0xfe,
+  0xff, 0xff, 0xe8, 0x61, 0xfe, 0xff, 0xff, 0x48, 0x31, 0xd2, 0xbb, 0x00,
+  0xca, 0x9a, 0x3b, 0x48, 0xf7, 0xf3, 0x48, 0x01, 0xc8, 0x48, 0x89, 0x07,
+  0x48, 0x89, 0xd0, 0x48, 0x31, 0xd2, 0xbb, 0xe8, 0x03, 0x00, 0x00, 0x48,
+  0xf7, 0xf3, 0x48, 0x89, 0x47, 0x08, 0x31, 0xc0, 0x5a, 0x59, 0xe9, 0x1a,
+  0xff, 0xff, 0xff, 0xb8, 0x60, 0x00, 0x00, 0x00, 0xe7, 0x00, 0xc3, 0xb8,
+  0x77, 0x04, 0x00, 0x00, 0xc3, 0xe7, 0x00, 0xf3, 0x48, 0x0f, 0xae, 0xd0,
   0x0f, 0x20, 0xd8, 0x0f, 0x22, 0xd8, 0x48, 0x0f, 0x07, 0x0f, 0x20, 0xd8,
   0x0f, 0x22, 0xd8, 0x48, 0x0f, 0x07, 0x48, 0x0f, 0x07, 0x50, 0x57, 0x0f,
   0x20, 0xd7, 0x8b, 0x44, 0x24, 0x10, 0xe7, 0x8e, 0x0f, 0x01, 0x3f, 0x5f,
   0x48, 0x85, 0xc0, 0x75, 0x07, 0x58, 0x48, 0x83, 0xc4, 0x08, 0x48, 0xcf,
-  0xf3, 0x48, 0x0f, 0xae, 0xd0, 0x51, 0x48, 0x0f, 0xb7, 0x05, 0x04, 0xfe,
+  0xf3, 0x48, 0x0f, 0xae, 0xd0, 0x51, 0x48, 0x0f, 0xb7, 0x05, 0x40, 0xfb,
   0xff, 0xff, 0x48, 0x8b, 0x4c, 0x24, 0x30, 0x0f, 0x01, 0xcb, 0x48, 0x89,
   0x01, 0x0f, 0x01, 0xca, 0x59, 0x58, 0x48, 0x83, 0xc4, 0x08, 0x48, 0xcf,
-  0xe7, 0xa1, 0x48, 0xcf, 0xe7, 0x80, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
-  0xe7, 0x81, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x82, 0x48, 0xcf,
-  0x90, 0x90, 0x90, 0x90, 0xe7, 0x83, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
-  0xe7, 0x84, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x85, 0x48, 0xcf,
-  0x90, 0x90, 0x90, 0x90, 0xe7, 0x86, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
-  0xe7, 0x87, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x88, 0xeb, 0x8e,
-  0x90, 0x90, 0x90, 0x90, 0xe7, 0x89, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
-  0xe7, 0x8a, 0xe9, 0x7b, 0xff, 0xff, 0xff, 0x90, 0xe7, 0x8b, 0xe9, 0x73,
-  0xff, 0xff, 0xff, 0x90, 0xe7, 0x8c, 0xe9, 0x6b, 0xff, 0xff, 0xff, 0x90,
-  0xe7, 0x8d, 0xe9, 0x63, 0xff, 0xff, 0xff, 0x90, 0xe9, 0x48, 0xff, 0xff,
-  0xff, 0x90, 0x90, 0x90, 0xe7, 0x8f, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
-  0xe7, 0x90, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x91, 0xe9, 0x43,
-  0xff, 0xff, 0xff, 0x90, 0xe7, 0x92, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
-  0xe7, 0x93, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x94, 0x48, 0xcf,
-  0x90, 0x90, 0x90, 0x90, 0xe9, 0x4f, 0xff, 0xff, 0xff
+  0xe7, 0xa1, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x80, 0x48, 0xcf,
+  0x90, 0x90, 0x90, 0x90, 0xe7, 0x81, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
+  0xe7, 0x82, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x83, 0x48, 0xcf,
+  0x90, 0x90, 0x90, 0x90, 0xe7, 0x84, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
+  0xe7, 0x85, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x86, 0x48, 0xcf,
+  0x90, 0x90, 0x90, 0x90, 0xe7, 0x87, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
+  0xe7, 0x88, 0xeb, 0x8a, 0x90, 0x90, 0x90, 0x90, 0xe7, 0x89, 0x48, 0xcf,
+  0x90, 0x90, 0x90, 0x90, 0xe7, 0x8a, 0xe9, 0x77, 0xff, 0xff, 0xff, 0x90,
+  0xe7, 0x8b, 0xe9, 0x6f, 0xff, 0xff, 0xff, 0x90, 0xe7, 0x8c, 0xe9, 0x67,
+  0xff, 0xff, 0xff, 0x90, 0xe7, 0x8d, 0xe9, 0x5f, 0xff, 0xff, 0xff, 0x90,
+  0xe9, 0x44, 0xff, 0xff, 0xff, 0x90, 0x90, 0x90, 0xe7, 0x8f, 0x48, 0xcf,
+  0x90, 0x90, 0x90, 0x90, 0xe7, 0x90, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
+  0xe7, 0x91, 0xe9, 0x3f, 0xff, 0xff, 0xff, 0x90, 0xe7, 0x92, 0x48, 0xcf,
+  0x90, 0x90, 0x90, 0x90, 0xe7, 0x93, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90,
+  0xe7, 0x94, 0x48, 0xcf, 0x90, 0x90, 0x90, 0x90, 0xe9, 0x4b, 0xff, 0xff,
+  0xff
 };
-unsigned int interrupts_len = 717;
+unsigned int interrupts_len = 1429;
@@ -77,6 +77,49 @@ iasm_header& mutable_interrupt_header() {
 	return *(iasm_header*) &interrupts[0];
 }
 
+static iasm_fastpath* fastpath_table() {
+	return (iasm_fastpath*) &interrupts[interrupt_header().vm64_fastpath_table];
+}
+bool set_interrupt_fastpath(uint32_t scall, iasm_fastpath::Kind kind, int64_t value)
+{
+	auto* table = fastpath_table();
+	for (unsigned i = 0; i < IASM_FASTPATH_MAX; i++) {
+		/* Replace an existing entry, or take the first free one */
+		if (table[i].kind == iasm_fastpath::None || table[i].scall == scall) {
+			table[i] = iasm_fastpath{scall, kind, 0, value};
+			return true;
+		}
+	}
+	return false;
+}
+void remove_interrupt_fastpath(uint32_t scall)
+{
+	auto* table = fastpath_table();
+	for (unsigned i = 0; i < IASM_FASTPATH_MAX; i++) {
+		if (table[i].kind == iasm_fastpath::None)
+			return;
+		if (table[i].scall == scall) {
+			/* Keep the table contiguous, the guest stops at None */
+			for (; i < IASM_FASTPATH_MAX-1; i++)
+				table[i] = table[i + 1];
+			table[IASM_FASTPATH_MAX-1] = iasm_fastpath{};
+			return;
+		}
+	}
+}
+
+void setup_interrupt_fastpath(void* except_area, uint64_t memory_end)
+{
+	auto* table = (iasm_fastpath*) ((char*)except_area + interrupt_header().vm64_fastpath_table);
+	for (unsigned i = 0; i < IASM_FASTPATH_MAX; i++) {
+		if (table[i].kind == iasm_fastpath::None)
+			return;
+		/* The value of the other kinds is unused */
+		if (table[i].kind != iasm_fastpath::Result)
+			table[i].value = memory_end;
+	}
+}
+
 void setup_amd64_exception_regs(struct kvm_sregs& sregs, uint64_t addr)
 {
 	sregs.idt.base  = addr;
@@ -20,13 +20,38 @@ struct iasm_header {
 	uint16_t vm64_except_size;
 	uint16_t vm64_dso;
 	uint16_t vm64_remote_return_addr;
-	uint32_t reserved1;
+	uint16_t vm64_syscall_nofast;
+	uint16_t vm64_fastpath_table;
 
-	uint64_t translated_vm_syscall(const vMemory& memory) const noexcept
+	uint64_t translated_vm_syscall(const vMemory& memory, bool fastpath = false) const noexcept
 	{
-		return memory.physbase + INTR_ASM_ADDR + vm64_syscall;
+		return memory.physbase + INTR_ASM_ADDR + (fastpath ? vm64_syscall : vm64_syscall_nofast);
 	}
 };
 const iasm_header& interrupt_header();
 iasm_header& mutable_interrupt_header();
+
+/* A system call answered by the guest kernel, without a VM exit */
+struct iasm_fastpath {
+	enum Kind : uint16_t {
+		None = 0,
+		Result = 1,      /* Return value */
+		Sigprocmask = 2, /* Return 0, all signals in oldset */
+		Time = 3,        /* time() from the KVM clock */
+		Gettimeofday = 4 /* gettimeofday() from the KVM clock */
+	};
+	/* Kinds other than Result write through guest pointers,
+	   and keep the end of guest memory in value instead. */
+	uint32_t scall;
+	uint16_t kind;
+	uint16_t reserved;
+	int64_t  value;
+};
+static constexpr unsigned IASM_FASTPATH_MAX = 24;
+/* Install into, or remove from, the fast path table of new VMs */
+extern bool set_interrupt_fastpath(uint32_t scall, iasm_fastpath::Kind, int64_t value);
+extern void remove_interrupt_fastpath(uint32_t scall);
+/* Bound the guest pointers written by the fast path table of a VM
+   to its guest memory. Other pointers are left to the host. */
+extern void setup_interrupt_fastpath(void* except_area, uint64_t memory_end);
 }
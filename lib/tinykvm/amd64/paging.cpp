@@ -6,9 +6,13 @@
 #include "../machine.hpp"
 #include "../page_streaming.hpp"
 #include "../util/elf.h"
+#include "../util/threadpool.h"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
+#include <sys/mman.h>
+#include <unordered_map>
 //#define KVM_VERBOSE_PAGETABLES
 
 #ifdef KVM_VERBOSE_PAGETABLES
@@ -143,6 +147,7 @@ uint64_t setup_amd64_paging(vMemory& memory,
 	static constexpr uint64_t PD_MASK = (1ULL << 30) - 1;
 	const size_t PD_PAGES = (memory.size + PD_MASK) >> 30;
 	const uint64_t PD_END = 0x3000 + PD_PAGES * 0x1000;
+	memory.tlb.invalidate();
 
 	// guest physical
 	const uint64_t pml4_addr = memory.page_tables;
@@ -471,7 +476,29 @@ void print_pagetables(const vMemory& memory)
 	}
 }
 
-void foreach_page(vMemory& memory, foreach_page_t callback, bool skip_oob_addresses)
+/* Visit the entries of one page directory and its page tables */
+static void foreach_page_pd(vMemory& memory, uint64_t pd_base, uint64_t pd_mem, const foreach_page_t& callback)
+{
+	auto* pd = memory.page_at(pd_mem);
+	for (uint64_t k = 0; k < 512; k++)
+	{
+		if (pd[k] & PDE64_PRESENT) {
+			const auto [pt_base, pt_mem, pt_size] = pt_from_index(k, pd_base, pd);
+			callback(pt_base, pd[k], pt_size);
+			if (!(pd[k] & PDE64_PS)) { // not 2MB page
+				auto* pt = memory.page_at(pt_mem);
+				for (uint64_t e = 0; e < 512; e++) {
+					const auto [pte_base, pte_mem, pte_size] = pte_from_index(e, pt_base, pt);
+					if (pt[e] & PDE64_PRESENT) { // 4KB page
+						callback(pte_base, pt[e], pte_size);
+					}
+				} // e
+			} // 2MB page
+		}
+	} // k
+}
+
+static void foreach_page_walk(vMemory& memory, const foreach_page_t& callback, bool skip_oob_addresses)
 {
 	auto* pml4 = memory.page_at(memory.page_tables);
 	for (size_t i = 0; i < 512; i++)
@@ -500,39 +527,82 @@ void foreach_page(vMemory& memory, foreach_page_t callback, bool skip_oob_addres
 					if (skip_oob_addresses && pd_mem >= memory.physbase + memory.size)
 						continue;
 
-					auto* pd = memory.page_at(pd_mem);
-					for (uint64_t k = 0; k < 512; k++)
-					{
-						if (pd[k] & PDE64_PRESENT) {
-							const auto [pt_base, pt_mem, pt_size] = pt_from_index(k, pd_base, pd);
-							callback(pt_base, pd[k], pt_size);
-							if (!(pd[k] & PDE64_PS)) { // not 2MB page
-								auto* pt = memory.page_at(pt_mem);
-								for (uint64_t e = 0; e < 512; e++) {
-									const auto [pte_base, pte_mem, pte_size] = pte_from_index(e, pt_base, pt);
-									if (pt[e] & PDE64_PRESENT) { // 4KB page
-										callback(pte_base, pt[e], pte_size);
-									}
-								} // e
-							} // 2MB page
-						}
-					} // k
+					foreach_page_pd(memory, pd_base, pd_mem, callback);
 				}
 			} // j
 		}
 	} // i
-} // foreach_page
+} // foreach_page_walk
+void foreach_page(vMemory& memory, foreach_page_t callback, bool skip_oob_addresses)
+{
+	/* The callback may modify any entry */
+	memory.tlb.invalidate();
+	foreach_page_walk(memory, callback, skip_oob_addresses);
+}
+void foreach_page_parallel(vMemory& memory, foreach_page_t callback, unsigned threads)
+{
+	memory.tlb.invalidate();
+	if (threads <= 1) {
+		foreach_page_walk(memory, callback, true);
+		return;
+	}
+	/* The PML4 and PDPT entries are visited here, and each 1GB
+	   region below them is walked by a thread in the pool. */
+	struct Region {
+		uint64_t pd_base;
+		uint64_t pd_mem;
+	};
+	std::vector<Region> regions;
+	auto* pml4 = memory.page_at(memory.page_tables);
+	for (size_t i = 0; i < 512; i++)
+	{
+		if (!(pml4[i] & PDE64_PRESENT))
+			continue;
+		const auto [pdpt_base, pdpt_mem, pdpt_size] = pdpt_from_index(i, pml4);
+		callback(pdpt_base, pml4[i], pdpt_size);
+		if (pdpt_mem >= memory.physbase + memory.size)
+			continue;
+
+		auto* pdpt = memory.page_at(pdpt_mem);
+		for (uint64_t j = 0; j < 512; j++)
+		{
+			if (!(pdpt[j] & PDE64_PRESENT))
+				continue;
+			const auto [pd_base, pd_mem, pd_size] = pd_from_index(j, pdpt_base, pdpt);
+			callback(pd_base, pdpt[j], pd_size);
+			if ((pdpt[j] & PDE64_PS) || pd_mem >= memory.physbase + memory.size)
+				continue;
+			regions.push_back({pd_base, pd_mem});
+		}
+	}
+	if (regions.size() <= 1) {
+		for (const auto& region : regions)
+			foreach_page_pd(memory, region.pd_base, region.pd_mem, callback);
+		return;
+	}
+
+	ThreadPool pool(std::min(size_t(threads), regions.size()), 0, false);
+	std::vector<std::future<void>> results;
+	results.reserve(regions.size());
+	for (const auto& region : regions) {
+		results.push_back(pool.enqueue([&memory, &callback, region] {
+			foreach_page_pd(memory, region.pd_base, region.pd_mem, callback);
+		}));
+	}
+	for (auto& result : results)
+		result.get();
+}
 void foreach_page(const vMemory& mem, foreach_page_t callback, bool skip_oob_addresses)
 {
-	foreach_page(const_cast<vMemory&>(mem), std::move(callback), skip_oob_addresses);
+	foreach_page_walk(const_cast<vMemory&>(mem), callback, skip_oob_addresses);
 }
 
-void foreach_page_makecow(vMemory& mem, uint64_t kernel_end, uint64_t shared_memory_boundary)
+void foreach_page_makecow(vMemory& mem, uint64_t kernel_end, uint64_t shared_memory_boundary, unsigned threads)
 {
 	if (UNLIKELY(shared_memory_boundary < kernel_end)) {
 		memory_exception("Shared memory boundary was illegal (zero)", shared_memory_boundary, 0u);
 	}
-	foreach_page(mem,
+	foreach_page_parallel(mem,
 	[=] (uint64_t addr, uint64_t& entry, size_t /*size*/) {
 		if (addr < shared_memory_boundary) {
 			const uint64_t flags = (PDE64_PRESENT | PDE64_RW);
@@ -545,8 +615,117 @@ void foreach_page_makecow(vMemory& mem, uint64_t kernel_end, uint64_t shared_mem
 		// Doing this makes it possible to send a dummy request to estimate which
 		// pages are needed after a fork, for use with MAP_POPULATE-like optimizations.
 		entry &= ~PDE64_ACCESSED;
+	}, threads);
+}
+size_t foreach_unlocked_relock(vMemory& mem)
+{
+	mem.tlb.invalidate();
+	size_t count = 0;
+	for (uint64_t* entry : mem.unlocked_entries) {
+		const uint64_t flags = (PDE64_PRESENT | PDE64_RW);
+		if ((*entry & flags) == flags) {
+			*entry &= ~PDE64_RW;
+			*entry |= PDE64_CLONEABLE | PDE64_G;
+			count++;
+		}
+	}
+	mem.unlocked_entries.clear();
+	return count;
+}
+static uint64_t page_hash(const uint64_t* page)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < 512; i++) {
+		hash = (hash ^ page[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
+DedupResult foreach_page_dedup(vMemory& mem, uint64_t kernel_end, uint64_t shared_memory_boundary, bool zeroes, bool identical)
+{
+	struct Leaf {
+		uint64_t* entry;
+		uint64_t  phys;
+	};
+	DedupResult result;
+	std::vector<Leaf> leaves;
+	std::vector<std::pair<uint64_t, uint64_t>> release; // Physical ranges
+	foreach_page(mem,
+	[&] (uint64_t addr, uint64_t& entry, size_t size) {
+		const bool leaf = (size == PDE64_PTE_SIZE) || (size == PDE64_PT_SIZE && (entry & PDE64_PS));
+		if (!leaf || addr < kernel_end || addr >= shared_memory_boundary)
+			return;
+		if ((entry & (PDE64_PRESENT | PDE64_USER)) != (PDE64_PRESENT | PDE64_USER))
+			return;
+		const uint64_t phys = entry & PDE64_ADDR_MASK;
+		if (!mem.within(phys, size))
+			return;
+		auto* page = (const uint64_t *)mem.at(phys, size);
+		bool zeroed = zeroes;
+		for (size_t n = 0; n < size / PAGE_SIZE && zeroed; n++)
+			zeroed = avx2_page_is_zeroed(page + n * 512);
+		if (zeroed) {
+			/* Forks will get zeroed pages instead of copies */
+			entry &= ~PDE64_DIRTY;
+			release.push_back({phys, size});
+			result.zero_pages += size / PAGE_SIZE;
+		} else if (identical && size == PAGE_SIZE && (entry & PDE64_RW)) {
+			leaves.push_back({&entry, phys});
+		}
 	});
+
+	if (identical && !leaves.empty()) {
+		/* Pages that are mapped more than once are left alone */
+		std::vector<uint64_t> physical;
+		foreach_page(mem,
+		[&] (uint64_t, uint64_t& entry, size_t size) {
+			if ((entry & PDE64_PRESENT) == 0)
+				return;
+			if (size == PDE64_PTE_SIZE)
+				physical.push_back(entry & PDE64_ADDR_MASK);
+			else if (size == PDE64_PT_SIZE && (entry & PDE64_PS)) {
+				for (uint64_t off = 0; off < PDE64_PT_SIZE; off += PAGE_SIZE)
+					physical.push_back((entry & PDE64_ADDR_MASK) + off);
+			}
+		});
+		std::sort(physical.begin(), physical.end());
+		auto mapped_once = [&] (uint64_t phys) {
+			auto range = std::equal_range(physical.begin(), physical.end(), phys);
+			return (range.second - range.first) == 1;
+		};
+		std::unordered_map<uint64_t, uint64_t> by_hash; // Hash to physical page
+		for (const auto& leaf : leaves) {
+			if (!mapped_once(leaf.phys))
+				continue;
+			auto* page = (const uint64_t *)mem.at(leaf.phys, PAGE_SIZE);
+			auto [it, inserted] = by_hash.try_emplace(page_hash(page), leaf.phys);
+			if (inserted)
+				continue;
+			if (std::memcmp(page, mem.at(it->second, PAGE_SIZE), PAGE_SIZE) != 0)
+				continue;
+			/* Share the first page with the same contents */
+			*leaf.entry = it->second | (*leaf.entry & ~PDE64_ADDR_MASK);
+			release.push_back({leaf.phys, PAGE_SIZE});
+			result.identical_pages++;
+		}
+	}
+
+	/* Give the pages back to the kernel, merging adjacent ranges.
+	   Anonymous memory reads back as zeroes afterwards. */
+	if (mem.has_snapshot_area() || !mem.owned)
+		return result;
+	std::sort(release.begin(), release.end());
+	for (size_t i = 0; i < release.size(); ) {
+		const uint64_t begin = release[i].first;
+		uint64_t end = begin + release[i].second;
+		for (i++; i < release.size() && release[i].first == end; i++)
+			end += release[i].second;
+		if (madvise(mem.at(begin, end - begin), end - begin, MADV_DONTNEED) == 0)
+			result.released_bytes += end - begin;
+	}
+	return result;
 }
+
 std::vector<std::pair<uint64_t, uint64_t>> get_accessed_pages(const vMemory& memory)
 {
 	std::vector<std::pair<uint64_t, uint64_t>> accessed_pages;
@@ -561,6 +740,8 @@ std::vector<std::pair<uint64_t, uint64_t>> get_accessed_pages(const vMemory& mem
 
 void page_at(vMemory& memory, uint64_t addr, foreach_page_t callback, bool ignore_missing)
 {
+	/* The callback may modify the entry */
+	memory.tlb.invalidate();
 	auto* pml4 = memory.page_at(memory.page_tables);
 	const uint64_t i = (addr >> 39) & 511;
 	if (pml4[i] & PDE64_PRESENT) {
@@ -613,14 +794,94 @@ inline bool is_copy_on_modify(uint64_t entry) {
 	return (entry & PDE64_CLONEABLE) == PDE64_CLONEABLE;
 }
 
-static void unlock_identity_mapped_entry(uint64_t& entry) {
+void build_page_table_template(const vMemory& memory, PageTableTemplate& tpl)
+{
+	tpl.entries.assign(512, 0);
+	tpl.fixups.clear();
+	std::memcpy(tpl.entries.data(), memory.page_at(memory.physbase + PT_ADDR), PAGE_SIZE);
+	for (const uint64_t addr : tpl.addresses) {
+		size_t table = 0;
+		/* Clone the PDPT, PD and PT on the way, as writable_page_at() would */
+		for (unsigned shift = 39; shift >= 21; shift -= 9) {
+			const size_t idx = table * 512 + ((addr >> shift) & 511);
+			const uint64_t entry = tpl.entries[idx];
+			if (std::find(tpl.fixups.begin(), tpl.fixups.end(), idx) != tpl.fixups.end()) {
+				table = (entry & PDE64_ADDR_MASK) / PAGE_SIZE;
+				continue;
+			}
+			if (!(entry & PDE64_PRESENT) || (entry & PDE64_PS) || !is_copy_on_write(entry))
+				break;
+			const size_t next = tpl.pages();
+			tpl.entries.resize(tpl.entries.size() + 512);
+			std::memcpy(&tpl.entries[next * 512], memory.page_at(entry & PDE64_ADDR_MASK), PAGE_SIZE);
+			/* The address is relative to the template until installed */
+			tpl.entries[idx] = (next * PAGE_SIZE) | (entry & PDE64_CLONED_MASK) | PDE64_RW;
+			tpl.fixups.push_back(idx);
+			table = next;
+		}
+	}
+	CLPRINT("Page table template: %zu pages for %zu addresses\n",
+		tpl.pages(), tpl.addresses.size());
+}
+bool install_page_table_template(vMemory& memory, const PageTableTemplate& tpl)
+{
+	const size_t count = tpl.pages();
+	MemoryBank::Page run;
+	try {
+		run = memory.banks.get_available_bank(count).get_next_page(count);
+	} catch (const MemoryException&) {
+		return false;
+	}
+	std::memcpy(run.pmem, tpl.entries.data(), count * PAGE_SIZE);
+	for (const uint32_t idx : tpl.fixups)
+		run.pmem[idx] += run.addr;
+	memory.set_page_tables(run.addr);
+	if (count > 2)
+		memory.remote_must_update_gigapages = true;
+	return true;
+}
+
+static void unlock_identity_mapped_entry(vMemory& memory, uint64_t& entry) {
+	memory.tlb.invalidate();
+	memory.record_host_write(&entry, sizeof(entry));
+	memory.unlocked_entries.push_back(&entry);
+	if (memory.numa_replicas != nullptr)
+		memory.numa_replicas->invalidate();
 	/* Make page directly writable */
 	entry &= ~(PDE64_CLONEABLE | PDE64_G);
 	entry |= PDE64_RW | PDE64_PRESENT;
 }
-static void clone_and_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags) {
-	/* Allocate new page, pass old vaddr to memory banks */
-	auto page = memory.new_page();
+/* Pages handed out one by one from a contiguous run of bank pages,
+   so that a range of copy-on-write entries costs one allocation.
+   Pages left over when the range ends early are given back. */
+struct PageBatch {
+	vMemory& memory;
+	MemoryBank::Page run {};
+	size_t used = 0;
+	size_t count = 0;
+	size_t wanted = 0; /* Pages still expected to be needed */
+
+	PageBatch(vMemory& mem) : memory(mem) {}
+	~PageBatch() {
+		if (this->used < this->count)
+			memory.give_back_pages(run, this->used);
+	}
+
+	MemoryBank::Page next() {
+		if (this->used == this->count) {
+			this->run = memory.new_pages(std::max(this->wanted, size_t(1)));
+			this->count = run.size / PAGE_SIZE;
+			this->used = 0;
+		}
+		if (this->wanted > 0)
+			this->wanted--;
+		const size_t n = this->used++;
+		return {run.pmem + n * (PAGE_SIZE / 8), run.addr + n * PAGE_SIZE, PAGE_SIZE, run.dirty};
+	}
+};
+
+static void clone_and_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags, const MemoryBank::Page& page) {
+	memory.tlb.invalidate();
 	assert((page.addr & 0x8000000000000FFF) == 0x0);
 	/* Copy all entries from old page */
 	tinykvm::page_duplicate(page.pmem, data);
@@ -628,26 +889,72 @@ static void clone_and_update_entry(vMemory& memory, uint64_t& entry, uint64_t*&
 	entry = page.addr | (entry & PDE64_CLONED_MASK) | flags;
 	data = page.pmem;
 }
-static void zero_and_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags) {
+static void clone_and_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags) {
 	/* Allocate new page, pass old vaddr to memory banks */
-	auto page = memory.new_page();
+	clone_and_update_entry(memory, entry, data, flags, memory.new_page());
+}
+static void zero_and_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags, const MemoryBank::Page& page) {
+	memory.tlb.invalidate();
+	/* The page has been zeroed by the memory bank, if it was dirty */
 	assert((page.addr & 0x8000000000000FFF) == 0x0);
-	/* Zero all entries from old page, if it's dirty */
-	if (page.dirty) {
-		tinykvm::page_memzero(page.pmem);
-	}
 	/* Set new entry, copy flags and set as cloned */
 	entry = page.addr | (entry & PDE64_CLONED_MASK) | flags;
 	data = page.pmem;
 }
-static void unsafe_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags) {
-	/* Allocate new page, pass old vaddr to memory banks */
-	auto page = memory.new_page();
+static void unsafe_update_entry(vMemory& memory, uint64_t& entry, uint64_t*& data, uint64_t flags, const MemoryBank::Page& page) {
+	memory.tlb.invalidate();
 	assert((page.addr & 0x8000000000000FFF) == 0x0);
 	/* Set new entry, copy flags and set as cloned */
 	entry = page.addr | (entry & PDE64_CLONED_MASK) | flags;
 	data = page.pmem;
 }
+/* New page for a 4KB leaf, from the batch when there is one */
+static MemoryBank::Page new_leaf_page(vMemory& memory, uint64_t addr, PageBatch* batch, bool zeroed) {
+	if (batch == nullptr)
+		return memory.new_clone_page(addr, zeroed);
+	auto page = batch->next();
+	if (zeroed && page.dirty) {
+		tinykvm::page_memzero(page.pmem);
+		page.dirty = false;
+	}
+	return page;
+}
+static bool leaf_needs_new_page(const vMemory& memory, uint64_t entry) {
+	return is_copy_on_write(entry) && (entry & PDE64_PRESENT)
+		&& !(memory.is_forkable_master() && memory.main_memory_writes);
+}
+/* Make a 4KB leaf entry writable, cloning it if it's copy-on-write.
+   The source is the original page, which a clone is copied from. */
+static uint64_t* writable_leaf_entry(vMemory& memory, uint64_t addr, uint64_t& entry,
+	uint64_t source, WritablePageOptions options, PageBatch* batch = nullptr)
+{
+	uint64_t* data = memory.page_at(source);
+	if (is_copy_on_write(entry)) {
+		if (memory.is_forkable_master() && memory.main_memory_writes) {
+			unlock_identity_mapped_entry(memory, entry);
+			memory.increment_unlocked_pages(1);
+		} else if (UNLIKELY(options.allow_dirty)) {
+			unsafe_update_entry(memory, entry, data, PDE64_RW | PDE64_PRESENT, new_leaf_page(memory, addr, batch, false));
+		} else if (options.zeroes || (entry & PDE64_DIRTY) == 0x0) {
+			zero_and_update_entry(memory, entry, data, PDE64_RW | PDE64_PRESENT, new_leaf_page(memory, addr, batch, true));
+		} else if (entry & PDE64_PRESENT) {
+			clone_and_update_entry(memory, entry, data, PDE64_RW | PDE64_PRESENT, new_leaf_page(memory, addr, batch, false));
+		} else {
+			// This entry already points to a new page, but we still need to copy
+			// the original page to the new one.
+			memory.tlb.invalidate();
+			page_duplicate(memory.page_at(entry & PDE64_ADDR_MASK), data);
+			entry &= ~PDE64_CLONEABLE;
+			entry |= PDE64_RW | PDE64_PRESENT;
+		}
+		if (entry & PDE64_USER)
+			memory.record_cow_leaf_user_page(addr, &entry, source, PAGE_SIZE);
+		if (memory.hugepage_policy != nullptr)
+			memory.hugepage_policy->record_write(addr);
+		CLPRINT("-> Cloning a PT entry: 0x%lX\n", entry);
+	}
+	return data;
+}
 
 WritablePage writable_page_at(vMemory& memory, uint64_t addr, uint64_t verify_flags, WritablePageOptions options)
 {
@@ -660,7 +967,7 @@ WritablePage writable_page_at(vMemory& memory, uint64_t addr, uint64_t verify_fl
 		/* Make copy of page if needed */
 		if (is_copy_on_write(pml4[i])) {
 			if (memory.main_memory_writes) {
-				unlock_identity_mapped_entry(pml4[i]);
+				unlock_identity_mapped_entry(memory, pml4[i]);
 			} else {
 				clone_and_update_entry(memory, pml4[i], pdpt, PDE64_RW);
 				CLPRINT("-> Cloning a PML4 entry %lu: 0x%lX at %p\n", i, pml4[i], pdpt);
@@ -674,7 +981,7 @@ WritablePage writable_page_at(vMemory& memory, uint64_t addr, uint64_t verify_fl
 			/* Make copy of page if needed */
 			if (is_copy_on_write(pdpt[j])) {
 				if (memory.main_memory_writes) {
-					unlock_identity_mapped_entry(pdpt[j]);
+					unlock_identity_mapped_entry(memory, pdpt[j]);
 				} else {
 					clone_and_update_entry(memory, pdpt[j], pd, PDE64_RW);
 					memory.remote_must_update_gigapages = true;
@@ -698,14 +1005,15 @@ WritablePage writable_page_at(vMemory& memory, uint64_t addr, uint64_t verify_fl
 
 					/* NOTE: Make sure we are re-reading pd[k] */
 					if (memory.main_memory_writes) {
-						unlock_identity_mapped_entry(pd[k]);
+						unlock_identity_mapped_entry(memory, pd[k]);
 						if (pd[k] & PDE64_PS) {
 							memory.increment_unlocked_pages(512);
 						}
 						goto entry_is_no_longer_copy_on_write;
-					} else if (memory.split_hugepages && (pd[k] & PDE64_PS)) { // 2MB page
+					} else if ((pd[k] & PDE64_PS) && memory.split_hugepage_at(addr)) { // 2MB page
 						CLPRINT("-> Splitting a 2MB page, addr=0x%lX rw=%lu cloneable=%lu\n",
 							addr, pd[k] & PDE64_RW, pd[k] & PDE64_CLONEABLE);
+						memory.tlb.invalidate();
 						/* Remove PS flag */
 						pd[k] &= ~(uint64_t)PDE64_PS;
 						/* Copy flags from 2MB page, except read-write */
@@ -726,14 +1034,16 @@ WritablePage writable_page_at(vMemory& memory, uint64_t addr, uint64_t verify_fl
 					else if ((pd[k] & PDE64_PS)) {
 						CLPRINT("Duplicating 2MB page, addr=0x%lX rw=%lu cloneable=%lu\n",
 							addr, pd[k] & PDE64_RW, pd[k] & PDE64_CLONEABLE);
+						memory.tlb.invalidate();
 
 						const bool dirty = pd[k] & PDE64_DIRTY;
 
 						/* Get the physical page at pt_base. */
 						auto* data = memory.page_at(pt_mem);
 
-						/* Set the new page address and bits, adding RW and removing DIRTY. */
-						auto page = memory.new_hugepage();
+						/* Set the new page address and bits, adding RW and removing DIRTY.
+						   When not duplicating, the memory bank zeroes the page if needed. */
+						auto page = memory.new_hugepage(!dirty);
 						uint64_t flags = (pd[k] & PDE64_PD_SPLIT_MASK) & ~PDE64_DIRTY;
 						pd[k] = page.addr | flags | PDE64_RW | PDE64_PRESENT;
 
@@ -749,18 +1059,12 @@ WritablePage writable_page_at(vMemory& memory, uint64_t addr, uint64_t verify_fl
 							for (size_t e = 0; e < 512; e++) {
 								tinykvm::page_duplicate(page.pmem + e * 512, data + e * 512);
 							}
-						} else if (page.dirty) {
-							/* The new page needs to be zeroed, because it's dirty */
-							//std::memset(page.pmem, 0, 2ULL << 20); /* 2MB */
-							for (size_t e = 0; e < 512; e++) {
-								tinykvm::page_memzero(page.pmem + e * 512);
-							}
 						}
 
 						/* Return 4k page offset to new duplicated page. */
 						const uint64_t e = index_from_pt_entry(addr);
 						if (pd[k] & PDE64_USER)
-							memory.record_cow_leaf_user_page(addr);
+							memory.record_cow_leaf_user_page(addr, &pd[k], pt_mem, PDE64_PT_SIZE);
 						return WritablePage {
 							.page = (char *)page.pmem + e * PAGE_SIZE,
 							.entry = pd[k],
@@ -785,43 +1089,24 @@ entry_is_no_longer_copy_on_write:
 						.entry = pd[k],
 						.size = PDE64_PT_SIZE,
 					};
+					memory.record_host_write(result.page, PAGE_SIZE);
 					return result;
 				}
 
 				const uint64_t e = index_from_pt_entry(addr);
 				if (pt[e] & (PDE64_PRESENT | PDE64_CLONEABLE)) { // 4KB page
-					const auto [pte_base, pte_mem, pte_size] = pte_from_index(e, pt_base, pt);
-					uint64_t* data;
+					/* The original page, which a clone is copied from */
+					uint64_t source;
 					if (pt[e] & PDE64_PRESENT) { // A regular copy-on-write entry
-						data = memory.page_at(pt[e] & ~(uint64_t)0x8000000000000FFF);
+						source = pt[e] & ~(uint64_t)0x8000000000000FFF;
 					} else { // An unpresent copy-on-write entry
 						// Reconstruct the address from the page table indices
-						const uint64_t pt_addr = pd_base + (k << 21) + (e << 12);
-						data = memory.page_at(pt_addr);
-					}
-					if (is_copy_on_write(pt[e])) {
-						if (memory.is_forkable_master() && memory.main_memory_writes) {
-							unlock_identity_mapped_entry(pt[e]);
-							memory.increment_unlocked_pages(1);
-						} else if (UNLIKELY(options.allow_dirty)) {
-							unsafe_update_entry(memory, pt[e], data, PDE64_RW | PDE64_PRESENT);
-						} else if (options.zeroes || (pt[e] & PDE64_DIRTY) == 0x0) {
-							zero_and_update_entry(memory, pt[e], data, PDE64_RW | PDE64_PRESENT);
-						} else if (pt[e] & PDE64_PRESENT) {
-							clone_and_update_entry(memory, pt[e], data, PDE64_RW | PDE64_PRESENT);
-						} else {
-							// This entry already points to a new page, but we still need to copy
-							// the original page to the new one.
-							page_duplicate(memory.page_at(pt[e] & PDE64_ADDR_MASK), data);
-							pt[e] &= ~PDE64_CLONEABLE;
-							pt[e] |= PDE64_RW | PDE64_PRESENT;
-						}
-						if (pt[e] & PDE64_USER)
-							memory.record_cow_leaf_user_page(addr);
-						CLPRINT("-> Cloning a PT entry: 0x%lX\n", pt[e]);
+						source = pd_base + (k << 21) + (e << 12);
 					}
+					uint64_t* data = writable_leaf_entry(memory, addr, pt[e], source, options);
 					if ((pt[e] & verify_flags) == verify_flags) {
 						CLPRINT("-> Returning data: %p\n", data);
+						memory.record_host_write(data, PAGE_SIZE);
 						return WritablePage {
 							.page = (char *)data,
 							.entry = pt[e],
@@ -840,6 +1125,151 @@ entry_is_no_longer_copy_on_write:
 	memory_exception("page_at: pml4 entry not present", addr, PDE64_PDPT_SIZE);
 }
 
+/* Find the page table of a 4KB page, once writable_page_at() has made
+   the levels above it writable. Also returns the base address that
+   unpresent copy-on-write entries are reconstructed from. */
+static uint64_t* leaf_table_at(vMemory& memory, uint64_t addr, uint64_t& pt_base)
+{
+	auto* pml4 = memory.page_at(memory.page_tables);
+	const uint64_t i = (addr >> 39) & 511;
+	if ((pml4[i] & PDE64_PRESENT) == 0)
+		return nullptr;
+	const auto [pdpt_base, pdpt_mem, pdpt_size] = pdpt_from_index(i, pml4);
+	auto* pdpt = memory.page_at(pdpt_mem);
+	const uint64_t j = index_from_pdpt_entry(addr);
+	if ((pdpt[j] & PDE64_PRESENT) == 0 || (pdpt[j] & PDE64_PS))
+		return nullptr;
+	const auto [pd_base, pd_mem, pd_size] = pd_from_index(j, pdpt_base, pdpt);
+	auto* pd = memory.page_at(pd_mem);
+	const uint64_t k = index_from_pd_entry(addr);
+	if ((pd[k] & PDE64_PRESENT) == 0 || (pd[k] & PDE64_PS) || is_copy_on_write(pd[k]))
+		return nullptr;
+	pt_base = pd_base + (k << 21);
+	return memory.page_at(pd[k] & PDE64_ADDR_MASK);
+}
+
+static void append_span(std::vector<WritableSpan>& spans, uint64_t addr, char* data, size_t len)
+{
+	if (!spans.empty()) {
+		auto& last = spans.back();
+		if (last.data + last.len == data && last.addr + last.len == addr) {
+			last.len += len;
+			return;
+		}
+	}
+	spans.push_back({addr, data, len});
+}
+
+void writable_spans_at(vMemory& memory, uint64_t addr, size_t len, uint64_t verify_flags,
+	WritablePageOptions options, bool dirty, std::vector<WritableSpan>& spans)
+{
+	while (len != 0)
+	{
+		/* The first page goes through the complete walk, which also
+		   clones or splits the levels above it, if needed. */
+		const uint64_t offset = addr & PageMask();
+		WritablePageOptions first_opts = options;
+		first_opts.allow_dirty = options.allow_dirty && offset == 0 && len >= PAGE_SIZE;
+		WritablePage wpage = writable_page_at(memory, addr & ~PageMask(), verify_flags, first_opts);
+		if (dirty)
+			wpage.set_dirty();
+
+		if (wpage.size == PDE64_PT_SIZE) {
+			/* The rest of the 2MB page is writable too */
+			const uint64_t offset2mb = addr & (PDE64_PT_SIZE - 1);
+			char* data = wpage.page - (offset2mb & ~PageMask()) + offset2mb;
+			const size_t size = std::min(size_t(PDE64_PT_SIZE - offset2mb), len);
+			memory.record_host_write(data, size);
+			append_span(spans, addr, data, size);
+			addr += size;
+			len -= size;
+			continue;
+		}
+		const size_t first_size = std::min(size_t(PAGE_SIZE - offset), len);
+		append_span(spans, addr, wpage.page + offset, first_size);
+		addr += first_size;
+		len -= first_size;
+		if (len == 0 || (addr & (PDE64_PT_SIZE - 1)) == 0)
+			continue;
+
+		/* Continue with the adjacent entries of the same page table */
+		uint64_t pt_base = 0;
+		uint64_t* pt = leaf_table_at(memory, addr, pt_base);
+		if (pt == nullptr)
+			continue;
+		const size_t e_begin = index_from_pt_entry(addr);
+		const size_t e_end = std::min(size_t(512), e_begin + (len + PageMask()) / PAGE_SIZE);
+		PageBatch batch { memory };
+		for (size_t e = e_begin; e < e_end; e++) {
+			if ((pt[e] & (PDE64_PRESENT | PDE64_CLONEABLE)) == 0)
+				break;
+			if (leaf_needs_new_page(memory, pt[e]))
+				batch.wanted++;
+		}
+
+		for (size_t e = e_begin; e < e_end; e++) {
+			/* Anything unusual is left to writable_page_at() */
+			if ((pt[e] & (PDE64_PRESENT | PDE64_CLONEABLE)) == 0)
+				break;
+			const uint64_t source = (pt[e] & PDE64_PRESENT)
+				? pt[e] & PDE64_ADDR_MASK : pt_base + (e << 12);
+			const size_t size = std::min(size_t(PAGE_SIZE), len);
+			WritablePageOptions opts = options;
+			opts.allow_dirty = options.allow_dirty && size == PAGE_SIZE;
+			uint64_t* data = writable_leaf_entry(memory, addr, pt[e], source, opts, &batch);
+			if (UNLIKELY((pt[e] & verify_flags) != verify_flags))
+				break;
+			if (dirty)
+				pt[e] |= PDE64_DIRTY;
+			memory.record_host_write(data, size);
+			append_span(spans, addr, (char *)data, size);
+			addr += size;
+			len -= size;
+		}
+	}
+}
+
+void prefault_writable_pages(vMemory& memory, const std::vector<uint64_t>& pages, uint64_t verify_flags)
+{
+	struct Leaf {
+		uint64_t  addr;
+		uint64_t* entry;
+		uint64_t  source;
+	};
+	std::vector<Leaf> leaves;
+	leaves.reserve(pages.size());
+	/* The first page of each 2MB region goes through the complete
+	   walk, which also clones or splits the levels above it. */
+	uint64_t region = ~uint64_t(0);
+	uint64_t* pt = nullptr;
+	uint64_t pt_base = 0;
+	for (const uint64_t addr : pages) {
+		if ((addr & ~(PDE64_PT_SIZE - 1)) != region) {
+			region = addr & ~(PDE64_PT_SIZE - 1);
+			writable_page_at(memory, addr, verify_flags);
+			pt = leaf_table_at(memory, addr, pt_base);
+			continue;
+		}
+		if (pt == nullptr) /* Cloned whole as a 2MB page */
+			continue;
+		uint64_t& entry = pt[index_from_pt_entry(addr)];
+		if (leaf_needs_new_page(memory, entry)) {
+			leaves.push_back({addr, &entry, entry & PDE64_ADDR_MASK});
+		} else if ((entry & verify_flags) != verify_flags) {
+			/* Anything unusual is left to writable_page_at() */
+			writable_page_at(memory, addr, verify_flags);
+		}
+	}
+	/* The rest are cloned in one pass into one contiguous run */
+	PageBatch batch { memory };
+	batch.wanted = leaves.size();
+	for (const auto& leaf : leaves) {
+		writable_leaf_entry(memory, leaf.addr, *leaf.entry, leaf.source, {}, &batch);
+		if (UNLIKELY((*leaf.entry & verify_flags) != verify_flags))
+			writable_page_at(memory, leaf.addr, verify_flags);
+	}
+}
+
 char * readable_page_at(const vMemory& memory, uint64_t addr, uint64_t flags)
 {
 	CLPRINT("Resolving a readable page for 0x%lX\n", addr);
@@ -886,6 +1316,13 @@ void memory_exception(const char* msg, uint64_t addr, uint64_t sz)
 	throw MemoryException(msg, addr, sz);
 }
 
+void remap_writable_page(vMemory& memory, WritablePage& wp, uint64_t phys)
+{
+	memory.tlb.invalidate();
+	wp.entry &= ~PDE64_ADDR_MASK;
+	wp.entry |= phys & PDE64_ADDR_MASK;
+	wp.set_dirty();
+}
 void WritablePage::set_dirty()
 {
 	entry |= PDE64_DIRTY;
@@ -13,7 +13,22 @@ extern void print_pagetables(const vMemory&);
 using foreach_page_t = std::function<void(uint64_t, uint64_t&, size_t)>;
 extern void foreach_page(vMemory&, foreach_page_t callback, bool skip_oob_addresses = true);
 extern void foreach_page(const vMemory&, foreach_page_t callback, bool skip_oob_addresses = true);
-extern void foreach_page_makecow(vMemory&, uint64_t kernel_end, uint64_t shared_memory_boundary);
+/* Walk the page tables with the given number of threads, each taking
+   1GB regions. The callback must be safe to call concurrently. */
+extern void foreach_page_parallel(vMemory&, foreach_page_t callback, unsigned threads);
+extern void foreach_page_makecow(vMemory&, uint64_t kernel_end, uint64_t shared_memory_boundary, unsigned threads = 1);
+/* Make the entries unlocked by direct main memory writes read-only
+   and cloneable again. Returns the number of entries re-locked. */
+extern size_t foreach_unlocked_relock(vMemory&);
+/* Find zero pages and/or identical writable 4K pages among the user
+   pages of main memory, and give their memory back to the kernel.
+   Translations cached by the vCPU must be flushed afterwards. */
+extern DedupResult foreach_page_dedup(vMemory&, uint64_t kernel_end, uint64_t shared_memory_boundary, bool zeroes, bool identical);
+/* Build the page table template from the master page tables, for the
+   addresses in the template, and install it as the root of a fork.
+   Installing returns false when there is no room for it in one bank. */
+extern void build_page_table_template(const vMemory&, PageTableTemplate&);
+extern bool install_page_table_template(vMemory&, const PageTableTemplate&);
 extern std::vector<std::pair<uint64_t, uint64_t>> get_accessed_pages(const vMemory& memory);
 
 extern void page_at(vMemory&, uint64_t addr, foreach_page_t, bool ignore_missing = false);
@@ -30,6 +45,21 @@ struct WritablePageOptions {
 	bool allow_dirty = false;
 };
 extern WritablePage writable_page_at(vMemory&, uint64_t addr, uint64_t flags, WritablePageOptions = {});
+/* Point the writable page at another physical page (also marks it dirty) */
+extern void remap_writable_page(vMemory&, WritablePage&, uint64_t phys);
+struct WritableSpan {
+	uint64_t addr; /* Guest virtual address */
+	char*    data;
+	size_t   len;
+};
+/* Make [addr, addr+len) writable, appending the host memory as spans
+   (adjacent pages are merged). The page tables are walked once per
+   2MB, and new pages for copy-on-write entries are allocated together. */
+extern void writable_spans_at(vMemory&, uint64_t addr, size_t len, uint64_t flags,
+	WritablePageOptions, bool dirty, std::vector<WritableSpan>&);
+/* Make the given sorted 4K pages writable, cloning the copy-on-write
+   leaves into one contiguous run of bank pages reserved up front. */
+extern void prefault_writable_pages(vMemory&, const std::vector<uint64_t>& pages, uint64_t flags);
 extern char * readable_page_at(const vMemory&, uint64_t addr, uint64_t flags);
 
 static inline bool page_is_zeroed(const uint64_t* page) {
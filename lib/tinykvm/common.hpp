@@ -14,11 +14,13 @@
 #define TINYKVM_COLD()   __attribute__ ((cold))
 
 #include <array>
+#include <atomic>
 #include <cstdint>
 #include <exception>
 #include <string>
 #include <string_view>
 #include <vector>
+#include "util/histogram.hpp"
 
 namespace tinykvm
 {
@@ -42,23 +44,63 @@ namespace tinykvm
 			UserDefined = 6,
 			Count = 7
 		};
-		// Each entry contains a list of times in nanoseconds
-		std::array<std::vector<uint64_t>, Count> times;
-		// Print profiling results. Side effect: *sorts vectors*
-		// when user_defined is non-empty, it will use that label
-		// instead of "UserDefined"
+		// Reasons the guest left KVM_RUN, as handled by the host
+		enum Exit {
+			ExitSyscall = 0,
+			ExitPageFaultRead = 1,
+			ExitPageFaultWrite = 2,
+			ExitPageFaultExec = 3,
+			ExitRemote = 4,  // Page fault on remote VM memory
+			ExitIO = 5,      // Custom input/output handlers
+			ExitMMIO = 6,
+			ExitDebug = 7,   // Breakpoints and KVM debug exits
+			ExitException = 8,
+			ExitCount = 9
+		};
+		// Each entry is a histogram of durations in TSC ticks
+		std::array<LatencyHistogram, Count> times;
+		// Host time spent handling each kind of VM exit, in TSC ticks
+		std::array<LatencyHistogram, ExitCount> exits;
+		// Histogram of a system call number, created on first use.
+		// Returns nullptr for numbers outside of the system call table.
+		LatencyHistogram* syscall(unsigned scall);
+
+		// Copies of all histograms, which can be merged with the
+		// snapshots of other machines, eg. a fleet of forks.
+		struct Snapshot {
+			std::array<HistogramSnapshot, Count> times;
+			std::array<HistogramSnapshot, ExitCount> exits;
+			std::vector<std::pair<unsigned, HistogramSnapshot>> syscalls; // Sorted
+			void merge(const Snapshot& other);
+			// When user_defined is non-empty, it will use that label
+			// instead of "UserDefined"
+			void print(const char* user_defined = "") const;
+		};
+		Snapshot snapshot() const;
+		// Print profiling results, see Snapshot::print()
 		void print(const char* user_defined = "") const;
 		// Clear all profiling samples
-		void reset() {
-			for (auto& vec : times)
-				vec.clear();
-		}
+		void reset();
 		void clear() { reset(); } // Alias
+
+		// The TSC is calibrated against CLOCK_MONOTONIC once per process
+		static double nanos_per_tick();
+		static uint64_t ticks_to_nanos(uint64_t ticks) {
+			return uint64_t(double(ticks) * nanos_per_tick());
+		}
+
+		MachineProfiling() = default;
+		MachineProfiling(const MachineProfiling&) = delete;
+		MachineProfiling& operator=(const MachineProfiling&) = delete;
+		~MachineProfiling();
+	private:
+		std::array<std::atomic<LatencyHistogram*>, TINYKVM_MAX_SYSCALLS> m_syscalls {};
 	};
 
 	struct MachineOptions {
 		uint64_t max_mem = 16ULL << 20; /* 16MB */
 		uint32_t max_cow_mem = 0;
+		uint32_t soft_cow_mem = 0; /* See Machine::set_memory_pressure_handler() */
 		uint32_t stack_size = 1600UL << 10; /* 1600KB */
 		uint32_t reset_free_work_mem = 0; /* reset_to() */
 		uint64_t dylink_address_hint = 0x200000; /* 2MB */
@@ -75,8 +117,37 @@ namespace tinykvm
 		   to their own main memory instead of memory banks,
 		   allowing forks to immediately see changes. */
 		bool master_direct_memory_writes = false;
+		/* When enabled, KVM logs guest writes to main memory, and
+		   host writes are recorded too, so that dirty_log_restore()
+		   can restore just the dirtied pages from the copy made by
+		   dirty_log_checkpoint(). Not for forks. */
+		bool dirty_log_main_memory = false;
 		/* When enabled, split hugepages during page faults. */
 		bool split_hugepages = false;
+		/* When enabled, forks decide for each 2MB region whether to
+		   clone a copy-on-write hugepage whole, or to split it, based
+		   on how densely the region was written before earlier resets.
+		   Overrides split_hugepages for forks. */
+		bool adaptive_hugepage_cow = false;
+		/* Average 4K page writes in a 2MB region before it is cloned whole. */
+		uint16_t adaptive_hugepage_threshold = 64;
+		/* When non-zero, a cloned copy-on-write page reserves this many
+		   bank pages for the guest pages that follow it, so that
+		   sequential writes stay contiguous in host memory. Reserved
+		   pages count against soft_cow_mem only once they are used. */
+		uint16_t clone_ahead_pages = 0;
+		/* When enabled, prepare_copy_on_write() finds all-zero user pages
+		   and gives them back to the kernel. Forks will get zeroed pages
+		   for them instead of copying. */
+		bool dedup_zero_pages = false;
+		/* When enabled, prepare_copy_on_write() also lets writable 4K user
+		   pages with identical contents share one page. Not supported with
+		   master_direct_memory_writes, snapshots or dirty logging. */
+		bool dedup_identical_pages = false;
+		/* Threads making the page tables copy-on-write in
+		   prepare_copy_on_write(), each walking 1GB regions.
+		   Worthwhile for masters with many GB of memory. */
+		uint16_t prepare_threads = 1;
 		/* When enabled, reset_to() will accept a different
 		   master VM than the original, but at a steep cost. */
 		bool allow_reset_to_new_master = false;
@@ -86,10 +157,23 @@ namespace tinykvm
 		/* When reset_enter_usermode is enabled, the guest will
 		   be forced into usermode after reset_to(). */
 		bool reset_enter_usermode = true;
+		/* When enabled, reset_to() skips threads and file descriptors
+		   as long as neither the master nor the fork has used them,
+		   for stateless tenants. Otherwise the full reset is done. */
+		bool reset_minimal = false;
 		/* When enabled, reset_to() will copy all memory
 		   from the master VM to the forked VM instead of
 		   resetting the memory banks. */
 		bool reset_keep_all_work_memory = false;
+		/* When enabled, reset_to() keeps dirty work memory resident
+		   instead of giving it back to the kernel, and pages are
+		   zeroed when they are handed out again. Only memory above
+		   reset_free_work_mem (when non-zero) is given back. */
+		bool reset_lazy_zeroing = false;
+		/* When enabled, memory banks are leased from and returned to
+		   a process-wide pool (MemoryBankPool), so that new forks get
+		   warm, already mapped banks. Implies reset_lazy_zeroing. */
+		bool shared_bank_pool = false;
 		/* Force-relocate fixed addresses with mmap(). */
 		bool relocate_fixed_mmap = true;
 		/* Make heap executable, to support JIT. */
@@ -115,6 +199,36 @@ namespace tinykvm
 		   hugepages, unless 0, in which case the entire
 		   main memory will be covered. */
 		size_t hugepages_arena_size = 0UL;
+		/* Advise transparent hugepages (MADV_HUGEPAGE) for memory
+		   banks not backed by explicit hugepages, and map them
+		   2MB-aligned so that the kernel can use them. */
+		bool transparent_hugepage_banks = false;
+		/* Bind main memory to the given NUMA node, or -1 for no
+		   binding. Memory banks are preferably allocated on this
+		   node too, unless numa_local_banks is enabled. */
+		int numa_node = -1;
+		/* Prefer allocating memory banks on the NUMA node of the
+		   thread that needs them, eg. a fork running on another node. */
+		bool numa_local_banks = false;
+		/* Forks running on another NUMA node than numa_node will use
+		   a copy of the main memory on their own node, made once by
+		   the first such fork. Requires numa_node. */
+		bool numa_replicate_main_memory = false;
+		/* Signal entered in the guest on the first system call after
+		   working memory crossed soft_cow_mem, when there is no memory
+		   pressure handler. The guest can then release caches before
+		   max_cow_mem is reached. 0: no signal. */
+		int soft_cow_mem_signal = 0;
+		/* Enforce execution timeouts with a process-wide watchdog
+		   thread instead of a POSIX timer armed and disarmed with
+		   system calls around each call into the guest. */
+		bool timeout_watchdog = false;
+		/* When enabled, the system calls installed with
+		   Machine::install_syscall_fastpath() before this VM (or
+		   its master) was created are answered by the guest kernel
+		   without a VM exit, as long as the VM has no threads besides
+		   the main thread. Not for SMP vCPUs. */
+		bool syscall_fastpath = false;
 	};
 
 	class MachineException : public std::exception {
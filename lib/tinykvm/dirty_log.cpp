@@ -0,0 +1,120 @@
+#include "dirty_log.hpp"
+
+#include "machine.hpp"
+#include "page_streaming.hpp"
+#include <cstring>
+#include <linux/kvm.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+namespace tinykvm {
+static constexpr bool VERBOSE_DIRTY_LOG = false;
+
+DirtyLog::DirtyLog(size_t memory_size)
+	: m_size(memory_size),
+	  m_dirty((memory_size / vMemory::PageSize() + 63) / 64),
+	  m_kvm_bitmap(m_dirty.size())
+{
+}
+DirtyLog::~DirtyLog()
+{
+	if (m_pristine != nullptr)
+		munmap(m_pristine, m_size);
+}
+
+void DirtyLog::merge_kvm_log() noexcept
+{
+	for (size_t i = 0; i < m_dirty.size(); i++)
+		m_dirty[i] |= m_kvm_bitmap[i];
+}
+
+void DirtyLog::checkpoint(const char* main_memory)
+{
+	if (m_pristine == nullptr) {
+		char* ptr = (char*) mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+		if (ptr == MAP_FAILED) {
+			throw MemoryException("Failed to allocate pristine main memory", 0, m_size);
+		}
+		this->m_pristine = ptr;
+	}
+	std::memcpy(m_pristine, main_memory, m_size);
+	std::fill(m_dirty.begin(), m_dirty.end(), 0);
+}
+
+std::vector<uint64_t> DirtyLog::dirty_pages() const
+{
+	std::vector<uint64_t> pages;
+	for (size_t w = 0; w < m_dirty.size(); w++) {
+		for (uint64_t bits = m_dirty[w]; bits != 0; bits &= bits - 1) {
+			pages.push_back((w * 64 + __builtin_ctzll(bits)) * vMemory::PageSize());
+		}
+	}
+	return pages;
+}
+
+size_t DirtyLog::restore(char* main_memory)
+{
+	size_t count = 0;
+	for (size_t w = 0; w < m_dirty.size(); w++) {
+		for (uint64_t bits = m_dirty[w]; bits != 0; bits &= bits - 1) {
+			const size_t offset = (w * 64 + __builtin_ctzll(bits)) * vMemory::PageSize();
+			page_duplicate((uint64_t *)&main_memory[offset], (const uint64_t *)&m_pristine[offset]);
+			count++;
+		}
+		m_dirty[w] = 0;
+	}
+	if constexpr (VERBOSE_DIRTY_LOG) {
+		printf("Dirty log: Restored %zu pages\n", count);
+	}
+	return count;
+}
+
+void Machine::harvest_dirty_log()
+{
+	auto* log = memory.dirty_log.get();
+	if (log == nullptr) {
+		throw MachineException("Dirty logging is not enabled (see dirty_log_main_memory)");
+	}
+	struct kvm_dirty_log dirty_log {};
+	dirty_log.slot = 0;
+	dirty_log.dirty_bitmap = log->kvm_bitmap();
+	/* Fetching the log also clears it, so it's merged into ours */
+	if (ioctl(this->fd, KVM_GET_DIRTY_LOG, &dirty_log) < 0) {
+		throw MachineException("KVM_GET_DIRTY_LOG failed");
+	}
+	log->merge_kvm_log();
+}
+
+void Machine::dirty_log_checkpoint()
+{
+	if (this->is_forked()) {
+		throw MachineException("Dirty logging is not supported on forks");
+	}
+	this->harvest_dirty_log();
+	memory.dirty_log->checkpoint(memory.ptr);
+}
+
+std::vector<uint64_t> Machine::dirty_log_pages()
+{
+	this->harvest_dirty_log();
+	auto pages = memory.dirty_log->dirty_pages();
+	for (auto& page : pages)
+		page += memory.physbase;
+	return pages;
+}
+
+size_t Machine::dirty_log_restore()
+{
+	this->harvest_dirty_log();
+	if (!memory.dirty_log->has_checkpoint()) {
+		throw MachineException("No dirty log checkpoint to restore");
+	}
+	memory.tlb.invalidate();
+	/* The copies of main memory are now stale */
+	if (memory.numa_replicas != nullptr)
+		memory.numa_replicas->invalidate();
+	return memory.dirty_log->restore(memory.ptr);
+}
+
+} // tinykvm
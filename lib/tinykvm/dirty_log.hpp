@@ -0,0 +1,49 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tinykvm {
+
+/* Dirty page tracking for the main memory of a VM that is not
+   forked. Guest writes are logged by KVM (KVM_MEM_LOG_DIRTY_PAGES
+   on slot 0), and host writes are recorded here, as KVM can not
+   see them. Together with a pristine copy of main memory made at
+   a checkpoint, only the dirtied pages need to be restored. */
+struct DirtyLog {
+	DirtyLog(size_t memory_size);
+	~DirtyLog();
+
+	/* Record a host write at the given offset into main memory. */
+	void record(ptrdiff_t offset, size_t len) noexcept {
+		if (offset < 0 || size_t(offset) >= m_size)
+			return;
+		const size_t first = size_t(offset) >> 12;
+		const size_t last  = (std::min(size_t(offset) + len, m_size) - 1) >> 12;
+		for (size_t page = first; page <= last; page++)
+			m_dirty[page / 64] |= 1ULL << (page % 64);
+	}
+
+	/* KVM_GET_DIRTY_LOG scratch bitmap, merged in with merge_kvm_log() */
+	uint64_t* kvm_bitmap() noexcept { return m_kvm_bitmap.data(); }
+	void merge_kvm_log() noexcept;
+
+	/* Copy main memory as the pristine state, and clear the log. */
+	void checkpoint(const char* main_memory);
+	bool has_checkpoint() const noexcept { return m_pristine != nullptr; }
+	/* Dirty pages since the last checkpoint or restore,
+	   as page offsets into main memory. */
+	std::vector<uint64_t> dirty_pages() const;
+	/* Copy the dirty pages back from the pristine copy, and
+	   clear the log. Returns the number of pages restored. */
+	size_t restore(char* main_memory);
+
+private:
+	size_t m_size;
+	char*  m_pristine = nullptr;
+	std::vector<uint64_t> m_dirty;
+	std::vector<uint64_t> m_kvm_bitmap;
+};
+
+}
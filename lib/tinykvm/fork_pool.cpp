@@ -0,0 +1,238 @@
+#include "fork_pool.hpp"
+
+#include "machine.hpp"
+#include <algorithm>
+#include <unistd.h>
+
+namespace tinykvm {
+static constexpr bool VERBOSE_FORK_POOL = false;
+
+ForkPool::ForkPool(size_t capacity)
+	: m_capacity(capacity)
+{
+}
+ForkPool::~ForkPool()
+{
+	/* Finish pending resets before the pooled forks go away */
+	this->m_reset_thread.reset();
+	this->clear();
+}
+
+/* The options used by reset_to() */
+static bool same_reset_options(const MachineOptions& a, const MachineOptions& b) noexcept
+{
+	return a.max_cow_mem == b.max_cow_mem
+		&& a.soft_cow_mem == b.soft_cow_mem
+		&& a.soft_cow_mem_signal == b.soft_cow_mem_signal
+		&& a.reset_free_work_mem == b.reset_free_work_mem
+		&& a.reset_copy_all_registers == b.reset_copy_all_registers
+		&& a.reset_enter_usermode == b.reset_enter_usermode
+		&& a.reset_keep_all_work_memory == b.reset_keep_all_work_memory
+		&& a.reset_lazy_zeroing == b.reset_lazy_zeroing
+		&& a.reset_minimal == b.reset_minimal;
+}
+bool ForkPool::Entry::is_reset_to(const Machine& master, const MachineOptions& options) const noexcept
+{
+	/* A master at the same address may be another VM, so compare
+	   serial numbers, and master commits since the reset */
+	return this->reset_serial == master.serial()
+		&& this->reset_generation == master.master_generation()
+		&& same_reset_options(this->reset_options, options);
+}
+
+std::unique_ptr<Machine> ForkPool::acquire(const Machine& master, const MachineOptions& options)
+{
+	Entry entry {};
+	bool preset = false;
+	{
+		std::scoped_lock lock(m_mtx);
+		m_stats.acquired++;
+		if (!m_forks.empty()) {
+			/* Prefer a fork that was already reset to this master */
+			auto it = std::find_if(m_forks.rbegin(), m_forks.rend(),
+				[&] (const Entry& e) { return e.is_reset_to(master, options); });
+			preset = it != m_forks.rend();
+			if (!preset)
+				it = m_forks.rbegin();
+			entry = std::move(*it);
+			m_forks.erase(std::next(it).base());
+			m_stats.reused++;
+			if (preset)
+				m_stats.preset++;
+		}
+	}
+
+	if (entry.machine != nullptr) {
+		try {
+			/* The vCPU timer signals the thread it was created on */
+			if (entry.tid != gettid())
+				entry.machine->migrate_to_this_thread();
+			if (preset) {
+				/* Already reset in the background */
+			} else if (entry.machine->is_fork_of(master)) {
+				entry.machine->reset_to(master, options);
+			} else {
+				/* Rebind to the new master, swapping main memories */
+				MachineOptions rebind = options;
+				rebind.allow_reset_to_new_master = true;
+				rebind.reset_keep_all_work_memory = false;
+				entry.machine->reset_to(master, rebind);
+				std::scoped_lock lock(m_mtx);
+				m_stats.rebound++;
+			}
+			return std::move(entry.machine);
+		} catch (const MachineException& e) {
+			if constexpr (VERBOSE_FORK_POOL) {
+				fprintf(stderr, "ForkPool: Failed to reset pooled fork: %s\n", e.what());
+			}
+			/* Fall back to creating a new fork */
+			entry.machine.reset();
+		}
+	}
+
+	auto fork = std::make_unique<Machine>(master, options);
+	std::scoped_lock lock(m_mtx);
+	m_stats.created++;
+	return fork;
+}
+
+void ForkPool::release(std::unique_ptr<Machine> fork)
+{
+	if (fork == nullptr)
+		return;
+	std::scoped_lock lock(m_mtx);
+	if (m_forks.size() < m_capacity) {
+		m_forks.push_back({std::move(fork), gettid()});
+		m_stats.released++;
+		return;
+	}
+	m_stats.destroyed++;
+	/* The fork is destroyed after the lock is released */
+}
+
+void ForkPool::release_async(std::unique_ptr<Machine> fork,
+	const Machine& master, const MachineOptions& options)
+{
+	if (fork == nullptr)
+		return;
+	ThreadTask<>* reset_thread = nullptr;
+	{
+		std::scoped_lock lock(m_mtx);
+		if (m_forks.size() >= m_capacity) {
+			m_stats.destroyed++;
+			return;
+		}
+		if (m_reset_thread == nullptr)
+			m_reset_thread.reset(new ThreadTask<>(0, true));
+		reset_thread = m_reset_thread.get();
+	}
+	/* The timer stays with the releasing thread, as the
+	   background thread does not run the fork. */
+	const pid_t tid = gettid();
+	Machine* machine = fork.release();
+	reset_thread->enqueue([this, machine, tid, &master, options] () -> long {
+		std::unique_ptr<Machine> fork { machine };
+		const uint32_t generation = master.master_generation();
+		try {
+			if (fork->is_fork_of(master)) {
+				fork->reset_to(master, options);
+			} else {
+				MachineOptions rebind = options;
+				rebind.allow_reset_to_new_master = true;
+				rebind.reset_keep_all_work_memory = false;
+				fork->reset_to(master, rebind);
+			}
+		} catch (const std::exception& e) {
+			/* Nobody waits for the result, so count it here */
+			if constexpr (VERBOSE_FORK_POOL) {
+				fprintf(stderr, "ForkPool: Failed to reset fork in the background: %s\n", e.what());
+			}
+			std::scoped_lock lock(m_mtx);
+			m_stats.destroyed++;
+			return -1;
+		} catch (...) {
+			std::scoped_lock lock(m_mtx);
+			m_stats.destroyed++;
+			return -1;
+		}
+		std::scoped_lock lock(m_mtx);
+		m_stats.reset_async++;
+		if (m_forks.size() >= m_capacity) {
+			m_stats.destroyed++;
+			return 0;
+		}
+		m_forks.push_back({std::move(fork), tid, master.serial(), generation, options});
+		m_stats.released++;
+		return 0;
+	});
+}
+
+void ForkPool::wait_for_resets()
+{
+	ThreadTask<>* reset_thread = nullptr;
+	{
+		std::scoped_lock lock(m_mtx);
+		reset_thread = m_reset_thread.get();
+	}
+	if (reset_thread != nullptr)
+		reset_thread->wait_until_nothing_in_flight();
+}
+
+void ForkPool::warmup(const Machine& master, const MachineOptions& options, size_t n)
+{
+	n = std::min(n, this->capacity());
+	while (this->size() < n) {
+		auto fork = std::make_unique<Machine>(master, options);
+		std::scoped_lock lock(m_mtx);
+		m_stats.created++;
+		if (m_forks.size() >= m_capacity)
+			break;
+		m_forks.push_back({std::move(fork), gettid()});
+	}
+	if constexpr (VERBOSE_FORK_POOL) {
+		printf("ForkPool: Warmed up %zu forks\n", this->size());
+	}
+}
+
+void ForkPool::set_capacity(size_t forks)
+{
+	std::vector<Entry> excess;
+	{
+		std::scoped_lock lock(m_mtx);
+		this->m_capacity = forks;
+		while (m_forks.size() > forks) {
+			excess.push_back(std::move(m_forks.back()));
+			m_forks.pop_back();
+		}
+	}
+	/* Excess forks are destroyed outside of the lock */
+}
+size_t ForkPool::capacity() const noexcept
+{
+	std::scoped_lock lock(m_mtx);
+	return m_capacity;
+}
+size_t ForkPool::size() const noexcept
+{
+	std::scoped_lock lock(m_mtx);
+	return m_forks.size();
+}
+
+void ForkPool::clear()
+{
+	std::vector<Entry> forks;
+	{
+		std::scoped_lock lock(m_mtx);
+		forks.swap(m_forks);
+	}
+}
+
+ForkPool::Stats ForkPool::stats() const
+{
+	std::scoped_lock lock(m_mtx);
+	Stats stats = m_stats;
+	stats.pooled = m_forks.size();
+	return stats;
+}
+
+} // tinykvm
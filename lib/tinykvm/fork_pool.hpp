@@ -0,0 +1,87 @@
+#pragma once
+#include "common.hpp"
+#include "util/threadtask.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <sys/types.h>
+#include <vector>
+
+namespace tinykvm {
+struct Machine;
+
+/* Pool of forks that are no longer in use. Instead of destroying a
+   fork, and creating a new one with its own KVM VM, vCPU, timer and
+   memory slots, the fork is kept here and later reset to a master VM
+   with reset_to(). The master may be another prepared VM than the one
+   the fork was made from. Forks created on another thread are
+   migrated to the calling thread when acquired. Pooled forks must
+   be reset to a living master, so masters should outlive the pool. */
+struct ForkPool {
+	ForkPool(size_t capacity = 64);
+	~ForkPool();
+
+	/* A fork of master that is ready to be used. Taken from the pool
+	   when possible, otherwise a new fork is created. A fork that was
+	   already reset to master by release_async() is handed out as is,
+	   as long as master has not committed changes since, and the reset
+	   options given there are the same as the ones given here. */
+	std::unique_ptr<Machine> acquire(const Machine& master, const MachineOptions&);
+	/* Return a fork to the pool. When the pool is full, the fork
+	   is destroyed instead. */
+	void release(std::unique_ptr<Machine> fork);
+	/* Return a fork to the pool, after a background thread has reset
+	   it to master with the given options. An acquire() for the same
+	   master with the same options then only has to hand it over to
+	   the calling thread. The reset refers to master, which must stay
+	   alive until it is done: call wait_for_resets() before destroying
+	   a master given here. A fork that fails to reset is destroyed. */
+	void release_async(std::unique_ptr<Machine> fork, const Machine& master, const MachineOptions&);
+	/* Wait until all background resets have completed. */
+	void wait_for_resets();
+	/* Create new forks of master until the pool holds n forks. */
+	void warmup(const Machine& master, const MachineOptions&, size_t n);
+
+	/* Set the maximum number of pooled forks. Excess forks are destroyed. */
+	void set_capacity(size_t forks);
+	size_t capacity() const noexcept;
+	size_t size() const noexcept;
+	/* Destroy all pooled forks. */
+	void clear();
+
+	struct Stats {
+		uint64_t acquired;  /* Forks handed out */
+		uint64_t reused;    /* ... of which were taken from the pool */
+		uint64_t rebound;   /* ... of which were reset to another master */
+		uint64_t created;   /* Forks created, including by warmup() */
+		uint64_t released;  /* Forks returned to the pool */
+		uint64_t destroyed; /* Forks destroyed because the pool was full */
+		uint64_t reset_async; /* Forks reset by the background thread */
+		uint64_t preset;    /* Acquired forks that were already reset */
+		size_t   pooled;    /* Forks currently in the pool */
+	};
+	Stats stats() const;
+
+private:
+	struct Entry {
+		std::unique_ptr<Machine> machine;
+		pid_t tid; /* The thread its timer belongs to */
+		/* The master it was reset to in the background, if any,
+		   by serial number, and the master generation and options
+		   of that reset */
+		uint64_t reset_serial = 0;
+		uint32_t reset_generation = 0;
+		MachineOptions reset_options {};
+		bool is_reset_to(const Machine& master, const MachineOptions&) const noexcept;
+	};
+
+	mutable std::mutex m_mtx;
+	std::vector<Entry> m_forks;
+	size_t m_capacity;
+	Stats m_stats {};
+	/* Background reset thread, started on first use under m_mtx */
+	std::unique_ptr<ThreadTask<>> m_reset_thread;
+};
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <unordered_map>
+
+namespace tinykvm {
+
+/* Adaptive copy-on-write policy for 2MB leaf pages. Counts the 4K
+   pages written in each split 2MB region, and keeps an average over
+   resets. Densely written regions are cloned whole as a 2MB page
+   instead of being split, reducing TLB pressure on large heaps,
+   while sparse regions keep being split into 4K pages. */
+struct HugepagePolicy {
+	static constexpr unsigned REGION_SHIFT = 21;
+	/* Regions cloned whole are split again every so often,
+	   in order to measure whether they are still dense. */
+	static constexpr uint16_t RESAMPLE_ROUNDS = 32;
+	/* At most this many regions are tracked (8GB of memory). Writes
+	   to new regions are ignored until fold() drops cold regions. */
+	static constexpr size_t MAX_REGIONS = 4096;
+
+	explicit HugepagePolicy(unsigned threshold = 64) : m_threshold(threshold) {}
+
+	/* Returns true when the 2MB region at addr should be cloned whole. */
+	bool clone_whole(uint64_t addr) const noexcept {
+		auto it = m_regions.find(addr >> REGION_SHIFT);
+		return it != m_regions.end() && it->second.hot;
+	}
+	/* A 4K page was copied-on-write inside a split 2MB region. */
+	void record_write(uint64_t addr) {
+		/* Consecutive writes are usually to the same region */
+		const uint64_t key = addr >> REGION_SHIFT;
+		if (m_last != nullptr && m_last_key == key) {
+			m_last->writes++;
+			return;
+		}
+		auto it = m_regions.find(key);
+		if (it == m_regions.end()) {
+			if (m_regions.size() >= MAX_REGIONS)
+				return;
+			it = m_regions.emplace(key, Region{}).first;
+		}
+		m_last_key = key;
+		m_last = &it->second;
+		m_last->writes++;
+	}
+	/* Forget the writes since the last reset. Used when the pages
+	   written in earlier rounds are kept, and recorded again. */
+	void clear_writes() noexcept {
+		for (auto& [region, stats] : m_regions)
+			stats.writes = 0;
+	}
+	/* Fold the writes since the last reset into the average. */
+	void fold() noexcept {
+		m_last = nullptr;
+		for (auto it = m_regions.begin(); it != m_regions.end(); ) {
+			auto& stats = it->second;
+			if (stats.hot) {
+				if (++stats.rounds >= RESAMPLE_ROUNDS) {
+					/* Split the region once to measure it again */
+					stats.hot = false;
+					stats.resample = true;
+				}
+				++it;
+				continue;
+			}
+			if (stats.resample) {
+				stats.average = stats.writes;
+				stats.resample = false;
+			} else {
+				stats.average = (3 * stats.average + stats.writes) / 4;
+			}
+			stats.hot = stats.average >= m_threshold;
+			stats.rounds = 0;
+			stats.writes = 0;
+			/* Cold regions are dropped to make room for new ones */
+			if (stats.average == 0)
+				it = m_regions.erase(it);
+			else
+				++it;
+		}
+	}
+	size_t regions() const noexcept { return m_regions.size(); }
+	size_t hot_regions() const noexcept {
+		size_t count = 0;
+		for (const auto& [region, stats] : m_regions)
+			count += stats.hot;
+		return count;
+	}
+
+private:
+	struct Region {
+		uint16_t writes  = 0; /* 4K writes since the last reset */
+		uint16_t average = 0; /* Running average of writes */
+		uint16_t rounds  = 0; /* Resets since the region became hot */
+		bool     hot = false;
+		bool     resample = false;
+	};
+	std::unordered_map<uint64_t, Region> m_regions;
+	uint64_t m_last_key = 0;
+	Region*  m_last = nullptr;
+	const unsigned m_threshold;
+};
+
+}
@@ -42,6 +42,13 @@ namespace tinykvm
 		FileDescriptors(Machine& machine);
 		~FileDescriptors();
 		void reset_to(const FileDescriptors& other);
+		/// @brief Check if no file descriptors, epoll instances or
+		/// socket pairs have been created beyond stdio, not even closed
+		/// ones. The stdio entries are made by the constructor.
+		bool is_unused() const noexcept {
+			return m_total_fds_opened == 0 && m_epoll_fds.empty() && m_sockets.empty()
+				&& (m_fds.empty() || m_fds.rbegin()->first <= 2);
+		}
 
 		/// @brief Set a new starting virtual file descriptor. This is useful
 		/// when there exists a remote VM with its own set of virtual file
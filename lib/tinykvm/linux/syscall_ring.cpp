@@ -0,0 +1,174 @@
+#include "syscall_ring.hpp"
+
+#include "../machine.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <sys/syscall.h>
+
+namespace tinykvm {
+static constexpr bool VERBOSE_SYSCALL_RING = false;
+
+/* Only system calls known to complete without switching threads,
+   stopping the vCPU or otherwise changing the guest registers can
+   be queued. Eg. poll() and epoll_wait() may yield to another thread. */
+static bool syscall_ring_allowed(uint32_t scall)
+{
+	switch (scall) {
+	case SYS_read:
+	case SYS_write:
+	case SYS_close:
+	case SYS_stat:
+	case SYS_fstat:
+	case SYS_lstat:
+	case SYS_lseek:
+	case SYS_mmap:
+	case SYS_mprotect:
+	case SYS_munmap:
+	case SYS_brk:
+	case SYS_ioctl:
+	case SYS_pread64:
+	case SYS_pwrite64:
+	case SYS_writev:
+	case SYS_access:
+	case SYS_mremap:
+	case SYS_madvise:
+	case SYS_dup:
+	case SYS_getpid:
+	case SYS_sendto:
+	case SYS_recvfrom:
+	case SYS_sendmsg:
+	case SYS_recvmsg:
+	case SYS_shutdown:
+	case SYS_uname:
+	case SYS_fcntl:
+	case SYS_fsync:
+	case SYS_ftruncate:
+	case SYS_getcwd:
+	case SYS_readlink:
+	case SYS_gettimeofday:
+	case SYS_getuid:
+	case SYS_getgid:
+	case SYS_geteuid:
+	case SYS_getegid:
+	case SYS_getppid:
+	case SYS_time:
+	case SYS_getdents64:
+	case SYS_clock_gettime:
+	case SYS_clock_getres:
+	case SYS_openat:
+	case SYS_newfstatat:
+	case SYS_epoll_ctl:
+	case SYS_sendmmsg:
+	case SYS_getrandom:
+	case SYS_statx:
+	case SYS_readlinkat:
+	case SYS_faccessat:
+	case SYS_sysinfo:
+		return true;
+	default:
+		return false;
+	}
+}
+
+void SyscallRing::system_call(vCPU& cpu, uint32_t scall)
+{
+	auto& regs = cpu.registers();
+	if (scall == SETUP)
+		regs.rax = this->setup(regs.rdi, regs.rsi);
+	else
+		regs.rax = this->enter(cpu);
+	cpu.set_registers(regs);
+}
+
+long SyscallRing::setup(uint64_t ring, uint64_t n)
+{
+	if (ring == 0) {
+		/* Unregister the ring */
+		this->addr = 0;
+		this->entries = 0;
+		return 0;
+	}
+	if ((ring & 0x7) != 0 || n == 0 || n > MAX_ENTRIES || (n & (n-1)) != 0)
+		return -EINVAL;
+	this->addr = ring;
+	this->entries = n;
+	if constexpr (VERBOSE_SYSCALL_RING) {
+		printf("Syscall ring at 0x%lX with %lu entries\n", ring, n);
+	}
+	return 0;
+}
+
+long SyscallRing::enter(vCPU& cpu)
+{
+	if (!this->active())
+		return -EINVAL;
+	auto& machine = cpu.machine();
+	Header hdr;
+	machine.copy_from_guest(&hdr, this->addr, sizeof(hdr));
+	if (hdr.sq_tail - hdr.sq_head > this->entries)
+		return -EINVAL;
+
+	/* Each entry gets the registers of the ENTER system call, with
+	   its own arguments. The registers are restored and the handled
+	   entries published also when a handler throws, so that no entry
+	   is handled twice. */
+	struct Finish {
+		SyscallRing& ring;
+		vCPU& cpu;
+		const tinykvm_x86regs saved;
+		Header& hdr;
+		long count = 0;
+		~Finish() {
+			cpu.registers() = saved;
+			try {
+				auto& machine = cpu.machine();
+				machine.copy_to_guest(ring.addr + offsetof(Header, sq_head), &hdr.sq_head, 4);
+				machine.copy_to_guest(ring.addr + offsetof(Header, cq_tail), &hdr.cq_tail, 4);
+			} catch (...) {
+				/* The ring itself is no longer writable */
+			}
+			ring.handled += count;
+			ring.enters++;
+		}
+	} finish { *this, cpu, cpu.registers(), hdr };
+	const bool was_stopped = cpu.stopped;
+	while (hdr.sq_head != hdr.sq_tail)
+	{
+		/* No room for the completion, the guest must make some */
+		if (hdr.cq_tail - hdr.cq_head >= this->entries)
+			break;
+
+		Submission sqe;
+		machine.copy_from_guest(&sqe, submission_addr(hdr.sq_head), sizeof(sqe));
+		Completion cqe { .user_data = sqe.user_data, .result = -EINVAL };
+		if (sqe.flags == 0 && syscall_ring_allowed(sqe.scall))
+		{
+			auto& regs = cpu.registers();
+			regs.rax = sqe.scall;
+			regs.rdi = sqe.args[0];
+			regs.rsi = sqe.args[1];
+			regs.rdx = sqe.args[2];
+			regs.r10 = sqe.args[3];
+			regs.r8  = sqe.args[4];
+			regs.r9  = sqe.args[5];
+			machine.system_call(cpu, sqe.scall);
+			cqe.result = cpu.registers().rax;
+			cpu.registers() = finish.saved;
+		}
+		if constexpr (VERBOSE_SYSCALL_RING) {
+			printf("Syscall ring: %u (user_data=0x%lX) = %ld\n",
+				sqe.scall, sqe.user_data, cqe.result);
+		}
+		machine.copy_to_guest(completion_addr(hdr.cq_tail), &cqe, sizeof(cqe));
+		hdr.sq_head++;
+		hdr.cq_tail++;
+		finish.count++;
+		/* The handler ended the guest, eg. with a fatal signal */
+		if (cpu.stopped && !was_stopped)
+			break;
+	}
+	return finish.count;
+}
+
+} // tinykvm
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+
+namespace tinykvm {
+struct vCPU;
+
+/* A submission/completion ring of system calls in guest memory, so
+   that a guest can queue many system calls and have them all handled
+   on one VM exit. The guest registers the ring with SETUP, and hands
+   the queued entries to the host with ENTER. Each entry is handled by
+   the regular system call handler, as if the guest had made the call.
+
+   Layout at the ring address: Header, Submission[entries],
+   Completion[entries]. The guest produces at sq_tail and consumes at
+   cq_head, the host consumes at sq_head and produces at cq_tail. The
+   indices run freely, and entries is a power of two. */
+struct SyscallRing {
+	static constexpr uint32_t SETUP = 0x1F710; /* rdi: ring, rsi: entries */
+	static constexpr uint32_t ENTER = 0x1F711; /* Returns handled entries */
+	static constexpr uint32_t MAX_ENTRIES = 4096;
+
+	struct Header {
+		uint32_t sq_head;
+		uint32_t sq_tail;
+		uint32_t cq_head;
+		uint32_t cq_tail;
+		uint32_t entries;
+		uint32_t reserved[3];
+	};
+	struct Submission {
+		uint32_t scall;
+		uint32_t flags; /* Unused, must be zero */
+		uint64_t user_data;
+		uint64_t args[6];
+	};
+	struct Completion {
+		uint64_t user_data;
+		int64_t  result;
+	};
+
+	bool active() const noexcept { return addr != 0; }
+	/* SETUP and ENTER, with the arguments in the guest registers */
+	void system_call(vCPU&, uint32_t scall);
+
+	uint64_t addr = 0;
+	uint32_t entries = 0;
+	/* Entries handled, and VM exits taken to handle them */
+	uint64_t handled = 0;
+	uint64_t enters = 0;
+
+private:
+	long setup(uint64_t ring, uint64_t entries);
+	long enter(vCPU&);
+	uint64_t submission_addr(uint32_t idx) const noexcept {
+		return addr + sizeof(Header) + (idx & (entries-1)) * sizeof(Submission);
+	}
+	uint64_t completion_addr(uint32_t idx) const noexcept {
+		return addr + sizeof(Header) + entries * sizeof(Submission)
+			+ (idx & (entries-1)) * sizeof(Completion);
+	}
+};
+static_assert(sizeof(SyscallRing::Header) == 32);
+static_assert(sizeof(SyscallRing::Submission) == 64);
+static_assert(sizeof(SyscallRing::Completion) == 16);
+
+} // tinykvm
@@ -1,5 +1,6 @@
 #include "../machine.hpp"
 #include "threads.hpp"
+#include "../amd64/idt.hpp"
 #include <cstring>
 #include <fcntl.h>
 #include <netinet/in.h>
@@ -3168,6 +3169,15 @@ void Machine::setup_linux_system_calls(bool unsafe_syscalls)
 
 	// Threads: clone, futex, block/tkill etc.
 	Machine::setup_multithreading();
+
+	/* Answered by the guest kernel with MachineOptions::syscall_fastpath.
+	   gettid() and sched_yield() only while the VM has no threads. */
+	Machine::install_syscall_fastpath(SYS_gettid, 1); /* Main thread */
+	Machine::install_syscall_fastpath(SYS_getpid, 0);
+	Machine::install_syscall_fastpath(SYS_sched_yield, 0);
+	set_interrupt_fastpath(SYS_rt_sigprocmask, iasm_fastpath::Sigprocmask, 0);
+	set_interrupt_fastpath(SYS_time, iasm_fastpath::Time, 0);
+	set_interrupt_fastpath(SYS_gettimeofday, iasm_fastpath::Gettimeofday, 0);
 }
 
 } // tinykvm
@@ -120,6 +120,18 @@ void MultiThreading::set_to_and_suspend_others(int tid)
 		}
 	}
 	this->m_current = get_thread(tid);
+	machine.cpu().update_syscall_fastpath();
+}
+bool MultiThreading::only_main_thread() const noexcept
+{
+	/* The current thread may just have been erased */
+	return m_threads.size() == 1 && m_threads.begin()->first == 1;
+}
+bool MultiThreading::same_main_thread(const MultiThreading& other) const noexcept
+{
+	return this->only_main_thread() && other.only_main_thread()
+		&& this->thread_counter == other.thread_counter
+		&& m_threads.begin()->second.clear_tid == other.m_threads.begin()->second.clear_tid;
 }
 
 Thread& MultiThreading::get_thread()
@@ -163,6 +175,8 @@ Thread& MultiThreading::create(
 		//THPRINT("CHILD_CLEARTID at 0x%lX\n", ctid);
 		thread.clear_tid = ctid;
 	}
+	/* gettid() and sched_yield() now depend on the current thread */
+	machine.cpu().update_syscall_fastpath();
 
 	return thread;
 }
@@ -184,6 +198,7 @@ void MultiThreading::erase_thread(int tid)
 	auto it = m_threads.find(tid);
 	assert(it != m_threads.end());
 	m_threads.erase(it);
+	machine.cpu().update_syscall_fastpath();
 }
 void MultiThreading::wakeup_next()
 {
@@ -207,6 +222,10 @@ struct MultiThreading& Machine::threads() {
 	}
 	return *m_mt;
 }
+bool Machine::is_multithreaded() const noexcept
+{
+	return m_mt != nullptr && !m_mt->only_main_thread();
+}
 
 void Machine::setup_multithreading()
 {
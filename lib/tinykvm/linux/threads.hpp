@@ -39,6 +39,10 @@ struct MultiThreading {
 	void reset_to(const MultiThreading& other);
 	void set_to_and_suspend_others(int tid);
 	size_t size() const { return m_threads.size(); }
+	/* True when the main thread is the only thread. */
+	bool only_main_thread() const noexcept;
+	/* True when both only have a main thread, in the same state. */
+	bool same_main_thread(const MultiThreading& other) const noexcept;
 	const std::map<int, Thread>& threads() const { return m_threads; }
 
 	MultiThreading(Machine&);
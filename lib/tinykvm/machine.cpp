@@ -4,6 +4,7 @@
 #include "smp.hpp"
 #include "util/scoped_profiler.hpp"
 #include "util/threadpool.h"
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <fcntl.h>
@@ -27,6 +28,12 @@ namespace tinykvm {
 	static int kvm_open();
 	constexpr uint64_t PageMask = vMemory::PageSize()-1;
 
+uint64_t Machine::next_serial() noexcept
+{
+	static std::atomic<uint64_t> serial = 0;
+	return serial.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
 __attribute__ ((cold))
 Machine::Machine(std::string_view binary, const MachineOptions& options)
 	: m_forked {false},
@@ -104,7 +111,8 @@ Machine::Machine(const Machine& other, const MachineOptions& options)
 	  m_start_address {other.m_start_address},
 	  m_kernel_end    {other.m_kernel_end},
 	  m_mmap_cache    {other.m_mmap_cache},
-	  m_mt     {nullptr}
+	  m_mt     {nullptr},
+	  m_syscall_ring  {other.m_syscall_ring}
 {
 	assert(kvm_fd != -1 && "Call Machine::init() first");
 	if (!other.m_prepped || other.memory.main_memory_writes) {
@@ -140,6 +148,7 @@ Machine::Machine(const Machine& other, const MachineOptions& options)
 	if (other.m_mt != nullptr) {
 		m_mt.reset(new MultiThreading{*this});
 		m_mt->reset_to(*other.m_mt);
+		this->vcpu.update_syscall_fastpath();
 	}
 	/* Loan file descriptors from the master machine */
 	if (other.m_fds != nullptr) {
@@ -194,8 +203,7 @@ bool Machine::reset_to(const Machine& other, const MachineOptions& options)
 	this->remote_disconnect();
 
 	bool full_reset = false;
-	if (UNLIKELY(this->m_binary.begin() != other.m_binary.begin() ||
-		memory.compare(other.memory) == false))
+	if (UNLIKELY(!this->is_fork_of(other)))
 	{
 		if (options.allow_reset_to_new_master == false) {
 			throw MachineException("Swapping main memories not enabled (experimental)");
@@ -224,24 +232,37 @@ bool Machine::reset_to(const Machine& other, const MachineOptions& options)
 			this->install_memory(1, remote().memory.vmem(), true);
 		}
 		full_reset = true;
+	} else if (UNLIKELY(memory.stale_numa_replica(other.memory))) {
+		/* The master memory changed since our copy of it was made */
+		memory.fork_reset(other.memory, options);
+		this->delete_memory(0);
+		this->install_memory(0, memory.vmem(), true);
+		full_reset = true;
 	} else {
 		full_reset = memory.fork_reset(other, options);
 	}
 
 	this->m_just_reset = full_reset;
 	this->m_mmap_cache = other.m_mmap_cache;
+	this->m_syscall_ring.addr = other.m_syscall_ring.addr;
+	this->m_syscall_ring.entries = other.m_syscall_ring.entries;
 	this->vcpu.last_fault_address = 0;
 
-	if (other.has_threads() && has_threads()) {
-		this->m_mt->reset_to(*other.m_mt);
-	} else if (other.has_threads()) {
-		this->m_mt.reset(new MultiThreading{*this});
-		this->m_mt->reset_to(*other.m_mt);
+	if (options.reset_minimal && this->uses_no_subsystems(other)) {
+		/* Nothing besides memory and registers to reset */
 	} else {
-		m_mt = nullptr;
+		if (other.has_threads() && has_threads()) {
+			this->m_mt->reset_to(*other.m_mt);
+		} else if (other.has_threads()) {
+			this->m_mt.reset(new MultiThreading{*this});
+			this->m_mt->reset_to(*other.m_mt);
+		} else {
+			m_mt = nullptr;
+		}
+		this->vcpu.update_syscall_fastpath();
+		/* Reset the file descriptors */
+		this->fds().reset_to(other.fds());
 	}
-	/* Reset the file descriptors */
-	this->fds().reset_to(other.fds());
 
 	if (full_reset) {
 		this->setup_cow_mode(&other);
@@ -261,6 +282,24 @@ bool Machine::reset_to(const Machine& other, const MachineOptions& options)
 	return full_reset;
 }
 
+bool Machine::is_fork_of(const Machine& other) const noexcept
+{
+	return this->m_binary.begin() == other.m_binary.begin()
+		&& memory.compare(other.memory);
+}
+
+bool Machine::uses_no_subsystems(const Machine& other) const noexcept
+{
+	/* Threads and file descriptors must never have been used by
+	   the master, and must still be unused in this fork. A lone
+	   main thread, as set up by libc startup, must be unchanged. */
+	const bool same_threads = (m_mt == nullptr || other.m_mt == nullptr)
+		? m_mt == other.m_mt : m_mt->same_main_thread(*other.m_mt);
+	return same_threads
+		&& (other.m_fds == nullptr || other.m_fds->is_unused())
+		&& (this->m_fds == nullptr || this->m_fds->is_unused());
+}
+
 uint64_t Machine::stack_push(__u64& sp, const void* data, size_t length)
 {
 	sp = (sp - length) & ~(uint64_t) 0x7; // maintain word alignment
@@ -290,9 +329,13 @@ uint64_t Machine::stack_push_cstr(__u64& sp, const char* string, size_t length)
 void Machine::install_memory(uint32_t idx, const VirtualMem& mem,
 	[[maybe_unused]] bool readonly)
 {
+	uint32_t flags = readonly ? (uint32_t)KVM_MEM_READONLY : 0u;
+	/* Slot 0 is main memory */
+	if (idx == 0 && memory.dirty_log != nullptr)
+		flags |= KVM_MEM_LOG_DIRTY_PAGES;
 	const struct kvm_userspace_memory_region memreg {
 		.slot = idx,
-		.flags = readonly ? (uint32_t)KVM_MEM_READONLY : 0u,
+		.flags = flags,
 		.guest_phys_addr = mem.physbase,
 		.memory_size = mem.size,
 		.userspace_addr = (uintptr_t) mem.ptr,
@@ -5,6 +5,7 @@
 #include "mmap_cache.hpp"
 #include "linux/fds.hpp"
 #include "linux/signals.hpp"
+#include "linux/syscall_ring.hpp"
 #include "vcpu.hpp"
 #include <array>
 #include <cassert>
@@ -22,6 +23,7 @@ struct Machine
 	using numbered_syscall_t = void(*)(vCPU&, unsigned);
 	using io_callback_t = void(*)(vCPU&, unsigned, unsigned);
 	using printer_func = std::function<void(const char*, size_t)>;
+	using memory_pressure_func = std::function<void(Machine&, size_t)>;
 	using mmap_func_t = std::function<void(vCPU&, address_t, size_t, int, int, int, address_t)>;
 
 	/* Setup Linux env and run through main */
@@ -54,8 +56,21 @@ struct Machine
 	bool is_forkable() const noexcept { return m_prepped; }
 	void stop(bool = true);
 	bool stopped() const noexcept { return vcpu.stopped; }
+	/* Cancel the call in progress, eg. for load shedding. Safe to
+	   call from any thread. The call, including any remote call in
+	   it, ends with a MachineTimeoutException. Returns false when
+	   no call is in progress, and then nothing is cancelled. */
+	bool request_stop_async() { return vcpu.request_stop_async(); }
 	bool reset_to(const Machine&, const MachineOptions&); // true = full reset
+	/* True when reset_to(other) with reset_minimal can skip threads
+	   and file descriptors, as neither VM has used them. A lone main
+	   thread, as set up by libc startup, counts as unused when it is
+	   unchanged from the master. */
+	bool uses_no_subsystems(const Machine& other) const noexcept;
 	void reset_to(std::string_view binary, const MachineOptions&);
+	/* True when this fork shares the main memory of other, so that
+	   reset_to(other) does not have to swap main memories. */
+	bool is_fork_of(const Machine& other) const noexcept;
 
 	/* When zeroes == true, new pages will be zeroed instead of duplicated */
 	void copy_to_guest(address_t addr, const void*, size_t, bool zeroes = false);
@@ -138,7 +153,17 @@ struct Machine
 	std::pair<__u64, __u64> get_fsgs() const;
 	void set_tls_base(__u64 baseaddr);
 
-	static void install_syscall_handler(unsigned idx, syscall_t h) { m_syscalls.at(idx) = h; }
+	static void install_syscall_handler(unsigned idx, syscall_t h) { m_syscalls.at(idx) = h; remove_syscall_fastpath(idx); }
+	/* Answer the system call in the guest with a result that never
+	   changes, without a VM exit. Pure system calls only. Like system
+	   call handlers, the fast path table is process-wide, and should
+	   be set up before the first VM is created: each VM takes a copy
+	   of the table when created, and forks use the copy of their
+	   master, so VMs that already exist are not affected. Applies to
+	   VMs with MachineOptions::syscall_fastpath. Installing a handler
+	   for the system call removes it again, for new VMs only. */
+	static void install_syscall_fastpath(unsigned idx, int64_t result);
+	static void remove_syscall_fastpath(unsigned idx);
 	static void install_unhandled_syscall_handler(numbered_syscall_t h) { m_unhandled_syscall = h; }
 	static auto get_syscall_handler(unsigned idx) { return m_syscalls.at(idx); }
 	void system_call(vCPU&, unsigned no);
@@ -191,6 +216,9 @@ struct Machine
 
 	/* Multi-threading */
 	bool has_threads() const noexcept { return m_mt != nullptr; }
+	/* True when the guest has created threads besides its main thread.
+	   libc startup creates the threading state for the main thread. */
+	bool is_multithreaded() const noexcept;
 	const struct MultiThreading& threads() const;
 	struct MultiThreading& threads();
 	static void setup_multithreading();
@@ -203,6 +231,9 @@ struct Machine
 	Signals& signals();
 	SignalAction& sigaction(int sig);
 
+	/* Batched system calls, registered by the guest */
+	const SyscallRing& syscall_ring() const noexcept { return m_syscall_ring; }
+
 	/* File descriptors, lazily created */
 	FileDescriptors& fds();
 	const FileDescriptors& fds() const;
@@ -229,6 +260,27 @@ struct Machine
 	/* The extra used memory attached to a VM for copy-on-write mechanisms. */
 	size_t banked_memory_pages() const noexcept;
 	size_t banked_memory_bytes() const noexcept { return banked_memory_pages() * vMemory::PageSize(); }
+	/* Time taken by the last prepare_copy_on_write(), see MachineOptions::prepare_threads */
+	const PrepareStats& prepare_stats() const noexcept { return memory.prepare_stats; }
+	/* Working memory usage and peak since the last reset, in pages */
+	WorkMemoryStats work_memory_stats() const noexcept { return memory.banks.stats(); }
+	/* Called with the working memory in use, in bytes, on the first system
+	   call after it crossed MachineOptions::soft_cow_mem. Once per reset.
+	   Without a handler, MachineOptions::soft_cow_mem_signal is entered. */
+	void set_memory_pressure_handler(memory_pressure_func f) { m_memory_pressure = std::move(f); }
+	/* Pages deduplicated by prepare_copy_on_write(), see MachineOptions::dedup_zero_pages */
+	const DedupResult& dedup_stats() const noexcept { return memory.dedup_result; }
+	/* NUMA placement of main memory and memory banks */
+	NumaStats numa_stats() const;
+	/* Copy main memory as the state dirty_log_restore() returns to.
+	   Requires MachineOptions::dirty_log_main_memory. */
+	void dirty_log_checkpoint();
+	/* Guest-physical pages written since the last checkpoint or restore */
+	std::vector<uint64_t> dirty_log_pages();
+	/* Restore only the written pages of main memory from the checkpoint.
+	   Returns the number of restored pages. Registers are not restored.
+	   Like commit_master_changes(), not allowed with NUMA replicas. */
+	size_t dirty_log_restore();
 	/* The extra memory capacity attached to a VM for copy-on-write mechanisms. */
 	size_t banked_memory_allocated_pages() const noexcept; // How many pages out of the capacity are allocated (backed by memory)
 	size_t banked_memory_allocated_bytes() const noexcept { return banked_memory_allocated_pages() * vMemory::PageSize(); }
@@ -243,9 +295,36 @@ struct Machine
 	   be used after preparation. */
 	void prepare_copy_on_write(size_t max_work_mem = 0, uint64_t shared_memory_boundary = UINT64_MAX);
 	void set_main_memory_writable(bool v) { memory.main_memory_writes = v; }
+	/* Publish the writes made by this master VM directly to main memory
+	   (see set_main_memory_writable) to its forks, without redoing
+	   prepare_copy_on_write(). Only the page table entries unlocked since
+	   the last commit are made copy-on-write again, and direct writes
+	   are disabled. Forks pick up the new generation on their next reset.
+	   Returns the number of unlocked pages that were committed. */
+	size_t commit_master_changes();
+	uint32_t master_generation() const noexcept { return memory.master_generation; }
+	/* Process-wide unique number of this VM. Unlike its address,
+	   it is never reused by another VM. */
+	uint64_t serial() const noexcept { return m_serial; }
 	bool is_forked() const noexcept { return m_forked; }
 	bool uses_cow_memory() const noexcept { return m_forked || m_prepped; }
 	std::vector<std::pair<uint64_t, uint64_t>> get_accessed_pages() const;
+	/* Returns the sorted user pages written (or pre-faulted) by this fork
+	   since it was last reset. Eg. the write set of a warm-up request. */
+	std::vector<uint64_t> get_written_pages() const;
+	/* Set the user pages that forks of this master VM will copy-on-write
+	   in one batch when forked or fully reset, before entering the guest. */
+	void set_cow_prefault_pages(std::vector<uint64_t> pages);
+	/* Pre-build the page tables that forks of this master VM would clone
+	   for the stack, heap and TLS (and the given extra addresses), so that
+	   forks install them with one copy when forked or fully reset.
+	   Must be called after prepare_copy_on_write(). */
+	void set_page_table_template(std::vector<uint64_t> extra_addresses = {});
+	/* Pages in the page table template of this master VM, 0 when unset */
+	size_t page_table_template_pages() const noexcept { return memory.pt_template.pages(); }
+	/* This fork installed the page table template of its master when
+	   it was forked or last fully reset. */
+	bool installed_page_table_template() const noexcept { return memory.pt_template_installed; }
 
 	/* Remote VM through address space merging */
 	void remote_connect(Machine& other, bool connect_now = false);
@@ -324,6 +403,8 @@ private:
 	bool relocate_section(const char* section_name, const char* sym_section);
 	void setup_long_mode(const MachineOptions&);
 	void setup_cow_mode(const Machine*); // After prepare_copy_on_write and forking
+	void memory_pressure(); // After crossing the soft working memory limit
+	void harvest_dirty_log();
 	[[noreturn]] static void machine_exception(const char*, uint64_t = 0);
 	[[noreturn]] static void timeout_exception(const char*, uint32_t = 0);
 	void smp_vcpu_broadcast(std::function<void(vCPU&)>);
@@ -336,6 +417,7 @@ private:
 
 	vCPU  vcpu;
 	int   fd = 0;
+	uint64_t m_serial = next_serial();
 	bool  m_prepped = false;
 	bool  m_forked = false;
 	bool  m_just_reset = false;
@@ -366,6 +448,7 @@ private:
 	mutable std::unique_ptr<SMP> m_smp;
 	std::unique_ptr<Signals> m_signals = nullptr;
 	mutable std::unique_ptr<FileDescriptors> m_fds = nullptr;
+	SyscallRing m_syscall_ring;
 
 	Machine* m_remote = nullptr;
 	uint32_t m_remote_connections = 0;
@@ -374,6 +457,7 @@ private:
 
 	/* How to print exceptions, register dumps etc. */
 	printer_func m_printer = m_default_printer;
+	memory_pressure_func m_memory_pressure = nullptr;
 
 	static std::array<syscall_t, TINYKVM_MAX_SYSCALLS> m_syscalls;
 	static numbered_syscall_t m_unhandled_syscall;
@@ -384,6 +468,7 @@ private:
 	static mmap_func_t        m_mmap_func;
 
 	static int create_kvm_vm();
+	static uint64_t next_serial() noexcept;
 	static int kvm_fd;
 	static void* create_vcpu_timer();
 	friend struct vCPU;
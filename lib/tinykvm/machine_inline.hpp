@@ -20,6 +20,9 @@ inline void Machine::system_call(vCPU& cpu, unsigned idx)
 			handler(cpu);
 			return;
 		}
+	} else if (idx - SyscallRing::SETUP < 2) {
+		m_syscall_ring.system_call(cpu, idx);
+		return;
 	}
 	m_unhandled_syscall(cpu, idx);
 }
@@ -139,7 +139,7 @@ bool Machine::load_snapshot_state()
 		this->m_kernel_end = state.m_kernel_end;
 		this->m_mmap_cache.current() = state.mmap_current;
 		this->memory.main_memory_writes = state.main_memory_writes;
-		this->memory.page_tables = state.m_page_tables;
+		this->memory.set_page_tables(state.m_page_tables);
 
 		void* current = state.current;
 		// Load populate pages
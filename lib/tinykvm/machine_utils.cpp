@@ -14,29 +14,56 @@ namespace tinykvm {
 
 void Machine::memzero(address_t addr, size_t len)
 {
+	/* Pages that are not dirty are already zero. Contiguous dirty
+	   pages are made writable together, and 2MB pages are checked once. */
+	address_t run_begin = addr;
+	size_t run_len = 0;
+	auto zero_run = [&] {
+		if (run_len == 0)
+			return;
+		std::vector<WritableSpan> spans;
+		WritablePageOptions opts;
+		opts.zeroes = true;
+		writable_spans_at(memory, run_begin, run_len, memory.expectedUsermodeFlags(), opts, false, spans);
+		for (const auto& span : spans)
+			std::memset(span.data, 0, span.len);
+		run_len = 0;
+	};
 	while (len != 0)
 	{
-		const size_t offset = addr & PageMask();
-		const size_t size = std::min(vMemory::PageSize() - offset, len);
 		bool must_be_zeroed = false;
+		size_t page_size = vMemory::PageSize();
 		page_at(memory, addr & ~PageMask(),
-			[&must_be_zeroed] (address_t /*page_addr*/, uint64_t flags, size_t /*page_size*/) {
-				if ((flags & (1UL << 6)) == 0) {
-					/* This is not a dirty page, so we can skip zeroing it */
-					must_be_zeroed = false;
-				} else {
-					/* This is a dirty page, so we need to zero it */
-					must_be_zeroed = true;
-				}
+			[&] (address_t /*page_addr*/, uint64_t flags, size_t psize) {
+				/* Only dirty pages need to be zeroed */
+				must_be_zeroed = (flags & (1UL << 6)) != 0;
+				page_size = psize;
 			}, true); // Ignore missing pages
-		if (UNLIKELY(must_be_zeroed)) {
+		if (UNLIKELY(must_be_zeroed && has_remote() && is_foreign_address(addr))) {
+			/* Remote memory is made writable in the remote VM */
+			zero_run();
+			const size_t offset = addr & PageMask();
+			const size_t size = std::min(vMemory::PageSize() - offset, len);
 			auto* page = memory.get_writable_page(addr & ~PageMask(), memory.expectedUsermodeFlags(), true, false);
 			std::memset(&page[offset], 0, size);
+			addr += size;
+			len -= size;
+			continue;
+		}
+		const size_t offset = addr & (page_size - 1);
+		const size_t size = std::min(page_size - offset, len);
+		if (UNLIKELY(must_be_zeroed)) {
+			if (run_len == 0)
+				run_begin = addr;
+			run_len += size;
+		} else {
+			zero_run();
 		}
 
 		addr += size;
 		len -= size;
 	}
+	zero_run();
 }
 
 void Machine::copy_to_guest(address_t addr, const void* vsrc, size_t len, bool zeroes)
@@ -44,21 +71,45 @@ void Machine::copy_to_guest(address_t addr, const void* vsrc, size_t len, bool z
 	if (uses_cow_memory() || !memory.safely_within(addr, len))
 	{
 		auto* src = (const uint8_t *)vsrc;
+		if (len > vMemory::PageSize()) {
+			/* Larger copies make the whole range writable at once */
+			std::vector<WritableSpan> spans;
+			WritablePageOptions opts;
+			opts.allow_dirty = true; // Only used for fully overwritten pages
+			opts.zeroes = zeroes;
+			writable_spans_at(memory, addr, len, memory.expectedUsermodeFlags(), opts, true, spans);
+			for (const auto& span : spans) {
+				std::memcpy(span.data, src, span.len);
+				src += span.len;
+			}
+			return;
+		}
 		while (len != 0)
 		{
 			const size_t offset = addr & PageMask();
 			const size_t size = std::min(vMemory::PageSize() - offset, len);
-			const bool full_page = (size == vMemory::PageSize());
-			WritablePageOptions opts;
-			opts.allow_dirty = full_page;
-			opts.zeroes = zeroes;
-			// Get a writable page, possibly allocating a new one
-			WritablePage page = writable_page_at(memory, addr & ~PageMask(), memory.expectedUsermodeFlags(), opts);
-			// Page is always dirty
-			page.set_dirty();
+			const uint64_t vpage = addr & ~PageMask();
+			const bool use_tlb = memory.tlb_usable(vpage);
+			// Pages in the TLB are already writable and dirty
+			char* page_data = use_tlb ? memory.tlb.lookup(vpage, SoftTLB::UserWrite) : nullptr;
+			if (page_data == nullptr) {
+				const bool full_page = (size == vMemory::PageSize());
+				WritablePageOptions opts;
+				opts.allow_dirty = full_page;
+				opts.zeroes = zeroes;
+				// Get a writable page, possibly allocating a new one
+				WritablePage page = writable_page_at(memory, vpage, memory.expectedUsermodeFlags(), opts);
+				// Page is always dirty
+				page.set_dirty();
+				page_data = page.page;
+				if (use_tlb) {
+					memory.tlb.insert(vpage, page_data,
+						SoftTLB::UserWrite | SoftTLB::UserRead | SoftTLB::KernelRead);
+				}
+			}
 			// Copy data to the page
-			char* page_data = page.page;
 			std::memcpy(&page_data[offset], src, size);
+			memory.record_host_write(&page_data[offset], size);
 
 			addr += size;
 			src += size;
@@ -69,6 +120,7 @@ void Machine::copy_to_guest(address_t addr, const void* vsrc, size_t len, bool z
 	/* Original VM uses identity-mapped memory */
 	auto* dst = memory.safely_at(addr, len);
 	std::memcpy(dst, vsrc, len);
+	memory.record_host_write(dst, len);
 }
 
 void Machine::copy_from_guest(void* vdst, address_t addr, size_t len) const
@@ -172,39 +224,10 @@ size_t Machine::gather_buffers_from_range(
 size_t Machine::writable_buffers_from_range(
 	std::vector<WrBuffer>& buffers, address_t addr, size_t len)
 {
-	WrBuffer* last = nullptr;
-	while (len != 0)
-	{
-		auto wpage = writable_page_at(memory, addr & ~PageMask(), memory.expectedUsermodeFlags());
-		if (wpage.page == nullptr) {
-			throw MemoryException("Failed to allocate writable page for range", addr, vMemory::PageSize());
-		}
-		wpage.set_dirty();
-		size_t offset = 0;
-		size_t size = 0;
-		char* page = wpage.page;
-		if constexpr (true) {
-			// Find the pages real size and realign the 4k-offset page pointer
-			const size_t offset4k = addr & PageMask();
-			offset = addr & (wpage.size - 1);
-			size = std::min(wpage.size - offset, len);
-			page = wpage.page - offset + offset4k;
-		} else {
-			offset = addr & PageMask();
-			size = std::min(vMemory::PageSize() - offset, len);
-		}
-
-		auto* ptr = (char*) &page[offset];
-		if (last && ptr == last->ptr + last->len) {
-			last->len += size;
-		} else {
-			buffers.emplace_back();
-			last = &buffers.back();
-			last->ptr = ptr;
-			last->len = size;
-		}
-		addr += size;
-		len -= size;
+	std::vector<WritableSpan> spans;
+	writable_spans_at(memory, addr, len, memory.expectedUsermodeFlags(), {}, true, spans);
+	for (const auto& span : spans) {
+		buffers.push_back({span.data, span.len});
 	}
 	return buffers.size();
 }
@@ -298,6 +321,7 @@ bool Machine::mmap_backed_area(
 		}
 		// Now we need to install this memory region as guest physical memory
 		this->install_memory(region_idx, VirtualMem(mmap_phys_base, (char*)real_addr, size_memory), false);
+		this->memory.phys_index.insert(mmap_phys_base, (char*)real_addr, size_memory);
 		// Discover the filename of the fd
 		char fd_path[64];
 		snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
@@ -339,10 +363,8 @@ bool Machine::mmap_backed_area(
 				}
 			}
 
-			writable_page.entry &= ~PDE64_ADDR_MASK; // Clear the address bits
-			writable_page.entry |= (phys & PDE64_ADDR_MASK); // Set the new physical
+			remap_writable_page(memory, writable_page, phys);
 			writable_page.set_protections(prot);
-			writable_page.set_dirty(); // Mark the page as dirty
 			if constexpr (VERBOSE_FILE_BACKED_MMAP) {
 				printf("mmap: allocating page at 0x%lX -> 0x%lX, phys 0x%lX size %zu entry 0x%lX prot 0x%X\n",
 					virt, virt + vMemory::PageSize(), phys, writable_page.size, writable_page.entry, prot);
@@ -637,8 +659,99 @@ std::string Machine::memcstring(address_t src, size_t maxlen) const
 	return result;
 }
 
-void MachineProfiling::print(const char* user_defined) const {
-	std::array<std::string, 7> locnames = {
+MachineProfiling::~MachineProfiling()
+{
+	for (auto& hist : m_syscalls)
+		delete hist.load(std::memory_order_relaxed);
+}
+
+LatencyHistogram* MachineProfiling::syscall(unsigned scall)
+{
+	if (UNLIKELY(scall >= m_syscalls.size()))
+		return nullptr;
+	auto* hist = m_syscalls[scall].load(std::memory_order_acquire);
+	if (LIKELY(hist != nullptr))
+		return hist;
+	// Another vCPU may race us to create it
+	auto* created = new LatencyHistogram;
+	if (m_syscalls[scall].compare_exchange_strong(hist, created, std::memory_order_acq_rel))
+		return created;
+	delete created;
+	return hist;
+}
+
+MachineProfiling::Snapshot MachineProfiling::snapshot() const
+{
+	Snapshot snap;
+	for (size_t i = 0; i < times.size(); i++)
+		snap.times[i] = times[i].snapshot();
+	for (size_t i = 0; i < exits.size(); i++)
+		snap.exits[i] = exits[i].snapshot();
+	for (unsigned scall = 0; scall < m_syscalls.size(); scall++) {
+		const auto* hist = m_syscalls[scall].load(std::memory_order_acquire);
+		if (hist == nullptr) continue;
+		auto hsnap = hist->snapshot();
+		if (!hsnap.empty())
+			snap.syscalls.emplace_back(scall, std::move(hsnap));
+	}
+	return snap;
+}
+
+void MachineProfiling::reset()
+{
+	for (auto& hist : times)
+		hist.reset();
+	for (auto& hist : exits)
+		hist.reset();
+	// Keep the histograms, as other vCPUs may be recording into them
+	for (auto& hist : m_syscalls) {
+		auto* h = hist.load(std::memory_order_acquire);
+		if (h != nullptr)
+			h->reset();
+	}
+}
+
+double MachineProfiling::nanos_per_tick()
+{
+	static const double factor = [] {
+		const uint64_t t0 = time_ns();
+		const uint64_t c0 = profiling_ticks();
+		uint64_t t1;
+		do {
+			t1 = time_ns();
+		} while (t1 - t0 < 2'000'000ULL); // 2ms
+		const uint64_t c1 = profiling_ticks();
+		return (c1 > c0) ? double(t1 - t0) / double(c1 - c0) : 1.0;
+	}();
+	return factor;
+}
+
+void MachineProfiling::Snapshot::merge(const Snapshot& other)
+{
+	for (size_t i = 0; i < times.size(); i++)
+		times[i].merge(other.times[i]);
+	for (size_t i = 0; i < exits.size(); i++)
+		exits[i].merge(other.exits[i]);
+	for (const auto& [scall, hsnap] : other.syscalls) {
+		auto it = std::lower_bound(syscalls.begin(), syscalls.end(), scall,
+			[] (const auto& entry, unsigned value) { return entry.first < value; });
+		if (it != syscalls.end() && it->first == scall)
+			it->second.merge(hsnap);
+		else
+			syscalls.emplace(it, scall, hsnap);
+	}
+}
+
+static void print_histogram(const char* name, const HistogramSnapshot& hist)
+{
+	const auto ns = MachineProfiling::ticks_to_nanos;
+	printf("  %s: %lu samples, total = %luns, max = %luns, min = %luns, median = %luns, p99 = %luns\n",
+		name, hist.samples, ns(hist.total), ns(hist.max), ns(hist.min),
+		ns(hist.percentile(50.0)), ns(hist.percentile(99.0)));
+}
+
+void MachineProfiling::Snapshot::print(const char* user_defined) const {
+	std::array<const char*, Count> locnames = {
 		"vCPU Run",
 		"Reset",
 		"Syscall",
@@ -647,24 +760,37 @@ void MachineProfiling::print(const char* user_defined) const {
 		"Remote Resume",
 		"UserDefined"
 	};
+	static constexpr std::array<const char*, ExitCount> exitnames = {
+		"Exit: System call",
+		"Exit: Page fault (read)",
+		"Exit: Page fault (write)",
+		"Exit: Page fault (exec)",
+		"Exit: Remote page fault",
+		"Exit: Input/output",
+		"Exit: MMIO",
+		"Exit: Debug",
+		"Exit: CPU exception"
+	};
 	if (user_defined && *user_defined) {
 		locnames[UserDefined] = user_defined;
 	}
 	for (size_t i = 0; i < locnames.size(); i++) {
-		auto vec = this->times[i];
-		if (vec.empty()) continue;
-		// Sort the times to find min/max and median
-		std::sort(vec.begin(), vec.end());
-		uint64_t total = 0;
-		uint64_t maxv = vec.back();
-		uint64_t minv = vec.front();
-		uint64_t median = vec[vec.size() / 2];
-		for (auto t : vec) {
-			total += t;
-		}
-		printf("  %s: %lu samples, total = %luns, max = %luns, min = %luns, median = %luns\n",
-			locnames[i].c_str(), vec.size(), total, maxv, minv, median);
+		if (!this->times[i].empty())
+			print_histogram(locnames[i], this->times[i]);
+	}
+	for (size_t i = 0; i < exitnames.size(); i++) {
+		if (!this->exits[i].empty())
+			print_histogram(exitnames[i], this->exits[i]);
 	}
+	for (const auto& [scall, hist] : this->syscalls) {
+		char name[32];
+		snprintf(name, sizeof(name), "System call %u", scall);
+		print_histogram(name, hist);
+	}
+}
+
+void MachineProfiling::print(const char* user_defined) const {
+	this->snapshot().print(user_defined);
 }
 
 } // tinykvm
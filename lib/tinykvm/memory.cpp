@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <cstring>
 #include <fcntl.h>
+#include <linux/kvm.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <stdexcept>
@@ -29,10 +30,23 @@ vMemory::vMemory(Machine& m, const MachineOptions& options,
 	  owned(own), snapshot_fd(fd),
 	  main_memory_writes(options.master_direct_memory_writes),
 	  split_hugepages(options.split_hugepages),
+	  clone_ahead_pages(options.clone_ahead_pages),
+	  dedup_zero_pages(options.dedup_zero_pages),
+	  dedup_identical_pages(options.dedup_identical_pages),
+	  prepare_threads(options.prepare_threads),
 	  executable_heap(options.executable_heap),
 	  mmap_backed_files(options.mmap_backed_files),
 	  banks(m, options)
 {
+	if (options.adaptive_hugepage_cow) {
+		this->hugepage_policy.reset(new HugepagePolicy(options.adaptive_hugepage_threshold));
+	}
+	if (options.dirty_log_main_memory && own) {
+		this->dirty_log.reset(new DirtyLog(this->size));
+	}
+	if (options.numa_replicate_main_memory && options.numa_node >= 0 && own) {
+		this->numa_replicas.reset(new NumaReplicas(options.numa_node));
+	}
 	// Main memory is not always starting at 0x0
 	// The default top-level pagetable location
 	this->page_tables = this->physbase + PT_ADDR;
@@ -62,6 +76,24 @@ vMemory::vMemory(Machine& m, const MachineOptions& options, const vMemory& other
 	this->mmap_physical = other.mmap_physical;
 	this->remote_end = other.remote_end;
 	banks.init_from(other.banks);
+	this->master_generation = other.master_generation;
+	this->use_numa_replica(other);
+}
+void vMemory::use_numa_replica(const vMemory& other)
+{
+	/* Use the copy of the master main memory on this thread's node,
+	   unless the master is writing directly to its main memory. */
+	if (other.numa_replicas != nullptr && other.unlocked_pages == 0) {
+		char* replica = other.numa_replicas->get(NUMA::current_node(),
+			other.ptr, other.size, !other.has_snapshot_area());
+		if (replica != nullptr)
+			this->ptr = replica;
+	}
+}
+bool vMemory::stale_numa_replica(const vMemory& other) const noexcept
+{
+	return other.numa_replicas != nullptr && this->ptr != other.ptr &&
+		!other.numa_replicas->is_current(this->ptr);
 }
 vMemory::~vMemory()
 {
@@ -109,6 +141,7 @@ void vMemory::install_mmap_ranges(const Machine &other)
 		// Install the mmap range in a new memory slot
 		const unsigned region_idx = this->allocate_region_idx();
 		machine.install_memory(region_idx, range, false);
+		this->phys_index.insert(range.physbase, range.ptr, range.size);
 		// Record the mmap range
 		auto new_range = range;
 		new_range.bank_idx = region_idx;
@@ -122,6 +155,7 @@ void vMemory::delete_foreign_mmap_ranges()
 		const auto& range = *it;
 		if (range.physbase >= this->mmap_physical || range.physbase < this->mmap_physical_begin) {
 			machine.delete_memory(range.bank_idx);
+			this->phys_index.erase(range.physbase, range.size);
 			this->m_bank_idx_free_list.push_back(range.bank_idx);
 			if constexpr (VERBOSE_MMAP) {
 				printf("Removed foreign mmap range at 0x%lX of size %zu KiB file %s\n",
@@ -145,24 +179,70 @@ void vMemory::delete_foreign_banks()
 	this->foreign_banks.clear();
 }
 
-bool vMemory::compare(const vMemory& other)
+bool vMemory::compare(const vMemory& other) const
 {
-	return this->ptr == other.ptr;
+	return this->ptr == other.ptr ||
+		(other.numa_replicas != nullptr && other.numa_replicas->contains(this->ptr));
 }
 
-void vMemory::record_cow_leaf_user_page(uint64_t addr)
+void vMemory::record_cow_leaf_user_page(uint64_t addr, uint64_t* pte, uint64_t source, size_t size)
 {
-	// When running forked, record page address to be restored in fork_reset.
+	// When running forked, record the page in the bank it was
+	// allocated from, to be restored in fork_reset.
 	// Pages are assumed to be leaf user pages.
 	if (machine.is_forked()) {
-		auto it = std::lower_bound(cow_written_pages.begin(), cow_written_pages.end(), addr);
-		cow_written_pages.insert(it, addr);
+		static constexpr uint64_t PDE64_ADDR_MASK = ~0x8000000000000FFF;
+		const uint64_t paddr = *pte & PDE64_ADDR_MASK;
+		MemoryBank* bank = banks.bank_of(paddr);
+		if (UNLIKELY(bank == nullptr)) {
+			memory_exception("Copy-on-write page is not in a memory bank", addr, size);
+		}
+		bank->record_written((paddr - bank->addr) / PageSize(), MemoryBank::WrittenPage {
+			.vaddr  = addr & ~uint64_t(size - 1),
+			.pte    = pte,
+			.source = source & PDE64_ADDR_MASK,
+			.pages  = uint32_t(size / PageSize()),
+		});
+	}
+}
+std::vector<uint64_t> vMemory::cow_written_pages() const
+{
+	std::vector<uint64_t> pages;
+	for (const auto& bank : banks) {
+		bank.foreach_written([&] (uint32_t, const MemoryBank::WrittenPage& written) {
+			pages.push_back(written.vaddr);
+		});
+	}
+	std::sort(pages.begin(), pages.end());
+	return pages;
+}
+
+void vMemory::prefault_cow_pages(const std::vector<uint64_t>& pages)
+{
+	try {
+#ifdef TINYKVM_ARCH_AMD64
+		prefault_writable_pages(*this, pages, PDE64_PRESENT | PDE64_USER | PDE64_RW);
+#else
+#error "Implement me!"
+#endif
+	} catch (const MemoryException& e) {
+		/* Out of working memory: leave the rest to page faults */
+		if (!e.is_oom())
+			throw;
 	}
 }
 
 bool vMemory::fork_reset(const Machine& main_vm, const MachineOptions& options)
 {
-	if (options.reset_keep_all_work_memory) {
+	this->tlb.invalidate();
+	this->fold_hugepage_policy(options);
+	/* Pages committed by the master since the last reset may be
+	   stale in kept work memory, or cached with a clean DIRTY bit
+	   in our copies of the page tables. */
+	const bool new_generation =
+		this->master_generation != main_vm.main_memory().master_generation;
+	this->master_generation = main_vm.main_memory().master_generation;
+	if (options.reset_keep_all_work_memory && !new_generation) {
 		// With this method, instead of resetting the memory banks,
 		// and the pagetables, which requires an expensive mov cr3,
 		// we will iterate the pagetables and copy non-CoW pages
@@ -179,27 +259,30 @@ bool vMemory::fork_reset(const Machine& main_vm, const MachineOptions& options)
 				vMemory::PageSize();
 			if (used > uint64_t(options.reset_free_work_mem)) {
 				//fprintf(stderr, "Freeing %zu bytes of work memory\n", used);
-				this->banks.reset(options);
-				cow_written_pages.clear();
+				this->reset_banks(options);
 				return true;
 			}
 		}
-		// Restore the original memory from the master VM.
+		this->banks.begin_reset_window();
+		// Restore the original memory from the master VM, sweeping
+		// the written pages of each bank in order.
 		try {
-		for (const uint64_t addr : cow_written_pages) {
-			tinykvm::page_at(*this, addr, [&](uint64_t addr, uint64_t& entry, uint64_t page_size) {
-				static constexpr uint64_t PDE64_ADDR_MASK = ~0x8000000000000FFF;
-				const uint64_t bank_addr = entry & PDE64_ADDR_MASK;
-				//fprintf(stderr, "Copying virtual page %016lx from physical %016lx with size %lu\n",
-				//	addr, bank_addr, page_size);
-
-				// This is a writable page, we will copy it using the "real"
-				// address from the master VM.
-				auto* our_page = this->safely_at(bank_addr, page_size);
-				// Find the page in the main VM
-				page_duplicate((uint64_t*)our_page,
-					(const uint64_t*)main_vm.main_memory().safely_at(addr, page_size));
-			}, false);
+		static constexpr uint64_t PDE64_ADDR_MASK = ~0x8000000000000FFF;
+		const auto& main_memory = main_vm.main_memory();
+		for (auto& bank : this->banks) {
+			bank.foreach_written([&] (uint32_t page, const MemoryBank::WrittenPage& written) {
+				// The page table entry must still point at this page
+				const uint64_t paddr = bank.addr + page * PageSize();
+				if (UNLIKELY((*written.pte & PDE64_ADDR_MASK) != paddr)) {
+					memory_exception("fork_reset: written page was remapped", written.vaddr, paddr);
+				}
+				const size_t size = written.pages * PageSize();
+				auto* our_page = (uint64_t *)bank.at(paddr);
+				auto* src_page = (const uint64_t *)main_memory.safely_at(written.source, size);
+				for (size_t n = 0; n < written.pages; n++) {
+					page_duplicate(our_page + n * 512, src_page + n * 512);
+				}
+			});
 		}
 		return false;
 		} catch (const std::exception& e) {
@@ -209,8 +292,7 @@ bool vMemory::fork_reset(const Machine& main_vm, const MachineOptions& options)
 		/// Fallthrough to reset the memory banks
 	}
 	// Reset the memory banks (also fallback if the above fails)
-	banks.reset(options);
-	cow_written_pages.clear();
+	this->reset_banks(options);
 	return true;
 }
 void vMemory::fork_reset(const vMemory& other, const MachineOptions& options)
@@ -220,7 +302,37 @@ void vMemory::fork_reset(const vMemory& other, const MachineOptions& options)
 	this->owned    = false;
 	this->ptr  = other.ptr;
 	this->size = other.size;
-	banks.reset(options);
+	this->master_generation = other.master_generation;
+	this->use_numa_replica(other);
+	this->tlb.invalidate();
+	this->fold_hugepage_policy(options);
+	this->reset_banks(options);
+}
+void vMemory::fold_hugepage_policy(const MachineOptions& options)
+{
+	if (this->hugepage_policy == nullptr)
+		return;
+	if (options.reset_keep_all_work_memory) {
+		/* Kept pages are not copied-on-write again, so the pages
+		   written in earlier rounds are counted again here. */
+		this->hugepage_policy->clear_writes();
+		for (const auto& bank : this->banks) {
+			bank.foreach_written([&] (uint32_t, const MemoryBank::WrittenPage& written) {
+				if (written.pages == 1)
+					this->hugepage_policy->record_write(written.vaddr);
+			});
+		}
+	}
+	this->hugepage_policy->fold();
+}
+void vMemory::reset_banks(const MachineOptions& options)
+{
+	/* Clone-ahead runs are pages reserved in the banks, so they
+	   are only dropped together with the banks. A kept-memory
+	   reset keeps them for the clones of the next request. */
+	this->m_clone_streams = {};
+	this->m_clone_clock = 0;
+	this->banks.reset(options);
 }
 bool vMemory::is_forkable_master() const noexcept
 {
@@ -231,38 +343,25 @@ char* vMemory::at(uint64_t addr, size_t asize)
 {
 	if (within(addr, asize))
 		return &ptr[addr - physbase];
-	for (auto& bank : banks) {
-		if (bank.within(addr, asize)) {
-			return bank.at(addr);
-		}
-	}
+	if (char* mem = phys_index.at(addr, asize); mem != nullptr)
+		return mem;
 	memory_exception("Memory::at() invalid region", addr, asize);
 }
 const char* vMemory::at(uint64_t addr, size_t asize) const
 {
 	if (within(addr, asize))
 		return &ptr[addr - physbase];
-	for (auto& bank : banks) {
-		if (bank.within(addr, asize)) {
-			return bank.at(addr);
-		}
-	}
+	if (const char* mem = phys_index.at(addr, asize); mem != nullptr)
+		return mem;
 	memory_exception("Memory::at() invalid region", addr, asize);
 }
 uint64_t* vMemory::page_at(uint64_t addr) const
 {
 	if (within(addr, PAGE_SIZE))
 		return (uint64_t *)&ptr[addr - physbase];
-	for (const auto& bank : banks) {
-		if (bank.within(addr, PAGE_SIZE))
-			return (uint64_t *)bank.at(addr);
-	}
-	/* mmap ranges */
-	for (const auto& vmem : mmap_ranges) {
-		if (addr >= vmem.physbase && addr < vmem.physbase + vmem.size) {
-			return (uint64_t *)(vmem.ptr + (addr - vmem.physbase));
-		}
-	}
+	/* Memory banks and mmap ranges */
+	if (char* mem = phys_index.at(addr, PAGE_SIZE); mem != nullptr)
+		return (uint64_t *)mem;
 	/* Remote machine always last resort */
 	if (machine.has_remote()) {
 		return machine.remote().main_memory().page_at(addr);
@@ -272,11 +371,8 @@ uint64_t* vMemory::page_at(uint64_t addr) const
 char* vMemory::safely_at(uint64_t addr, size_t asize)
 {
 	/* XXX: Security checks */
-	for (auto& bank : banks) {
-		if (bank.within(addr, asize)) {
-			return bank.at(addr);
-		}
-	}
+	if (char* mem = phys_index.at(addr, asize); mem != nullptr)
+		return mem;
 
 	if (safely_within(addr, asize))
 		return &ptr[addr - physbase];
@@ -293,11 +389,8 @@ const char* vMemory::safely_at(uint64_t addr, size_t asize) const
 	if (safely_within(addr, asize))
 		return &ptr[addr - physbase];
 	/* XXX: Security checks */
-	for (auto& bank : banks) {
-		if (bank.within(addr, asize)) {
-			return bank.at(addr);
-		}
-	}
+	if (const char* mem = phys_index.at(addr, asize); mem != nullptr)
+		return mem;
 	/* Remote machine always last resort */
 	if (machine.has_remote()) {
 		return machine.remote().main_memory().safely_at(addr, asize);
@@ -308,11 +401,8 @@ std::string_view vMemory::view(uint64_t addr, size_t asize) const {
 	if (safely_within(addr, asize))
 		return {&ptr[addr - physbase], asize};
 	/* XXX: Security checks */
-	for (const auto& bank : banks) {
-		if (bank.within(addr, asize)) {
-			return bank.at(addr);
-		}
-	}
+	if (const char* mem = phys_index.at(addr, asize); mem != nullptr)
+		return {mem, asize};
 	/* Remote machine always last resort */
 	if (machine.has_remote())
 	{
@@ -321,6 +411,33 @@ std::string_view vMemory::view(uint64_t addr, size_t asize) const {
 	memory_exception("vMemory::view failed", addr, asize);
 }
 
+void PhysicalIndex::insert(uint64_t phys, char* host, uint64_t size)
+{
+	if (UNLIKELY((phys & FRAME_MASK) != 0 || phys + size < phys)) {
+		throw MemoryException("PhysicalIndex: region must be 2MB-aligned", phys, size);
+	}
+	const uint64_t end = phys + size;
+	for (uint64_t addr = phys; addr < end; addr += (1ULL << FRAME_SHIFT)) {
+		const uint64_t dir = addr >> DIR_SHIFT;
+		if (dir >= m_dirs.size())
+			m_dirs.resize(dir + 1);
+		if (m_dirs[dir] == nullptr)
+			m_dirs[dir].reset(new Directory{});
+		auto& frame = (*m_dirs[dir])[(addr >> FRAME_SHIFT) & 511];
+		frame.host = host + (addr - phys);
+		frame.end  = end;
+	}
+}
+void PhysicalIndex::erase(uint64_t phys, uint64_t size)
+{
+	for (uint64_t addr = phys & ~FRAME_MASK; addr < phys + size; addr += (1ULL << FRAME_SHIFT)) {
+		const uint64_t dir = addr >> DIR_SHIFT;
+		if (dir < m_dirs.size() && m_dirs[dir] != nullptr) {
+			(*m_dirs[dir])[(addr >> FRAME_SHIFT) & 511] = Frame{};
+		}
+	}
+}
+
 vMemory::AllocationResult vMemory::allocate_mapped_memory(
 	const MachineOptions& options, size_t size)
 {
@@ -369,6 +486,10 @@ vMemory::AllocationResult vMemory::allocate_mapped_memory(
 			memory_exception("Failed to allocate guest memory", 0, size);
 		}
 	}
+	if (options.numa_node >= 0 && !NUMA::bind(ptr, size, options.numa_node, true)) {
+		munmap(ptr, size);
+		memory_exception("Failed to bind guest memory to NUMA node", options.numa_node, size);
+	}
 	int advice = 0x0;
 	if (!options.short_lived) {
 		advice |= MADV_MERGEABLE;
@@ -470,13 +591,67 @@ VirtualMem vMemory::vmem() const
 	return VirtualMem::New(physbase, ptr, size, remote_end);
 }
 
-MemoryBank::Page vMemory::new_page()
+MemoryBank::Page vMemory::new_page(bool zeroed)
 {
-	return banks.get_available_bank(1u).get_next_page(1u);
+	return banks.get_available_bank(1u).get_next_page(1u, zeroed);
+}
+MemoryBank::Page vMemory::new_pages(size_t n_pages, bool zeroed, bool ahead)
+{
+	auto& bank = banks.get_available_bank(1u);
+	n_pages = std::min(n_pages, size_t(bank.n_pages - bank.n_used));
+	return bank.get_next_page(n_pages, zeroed, ahead);
+}
+void vMemory::give_back_pages(const MemoryBank::Page& run, size_t used) noexcept
+{
+	auto* bank = banks.bank_of(run.addr);
+	const size_t unused = run.size / PageSize() - used;
+	if (bank == nullptr || unused == 0)
+		return;
+	bank->give_back(run.addr + used * PageSize(), unused);
+}
+MemoryBank::Page vMemory::new_clone_page(uint64_t vaddr, bool zeroed)
+{
+	if (this->clone_ahead_pages == 0)
+		return new_page(zeroed);
+	vaddr &= ~uint64_t(PageSize() - 1);
+	CloneStream* stream = nullptr;
+	for (auto& s : m_clone_streams) {
+		if (s.next_vaddr == vaddr && s.count > 0) {
+			stream = &s;
+			break;
+		}
+	}
+	if (stream == nullptr) {
+		/* Start a new stream in place of the least recently used one.
+		   Its remaining pages are taken over, so none are wasted. */
+		stream = &m_clone_streams[0];
+		for (auto& s : m_clone_streams) {
+			if (s.last_use < stream->last_use)
+				stream = &s;
+		}
+	}
+	if (stream->used == stream->count) {
+		/* The pages do not count against the soft limit until used */
+		stream->run = new_pages(1u + this->clone_ahead_pages, false, true);
+		stream->count = stream->run.size / PageSize();
+		stream->used = 0;
+	}
+	const size_t n = stream->used++;
+	banks.use_ahead_page();
+	stream->next_vaddr = vaddr + PageSize();
+	stream->last_use = ++m_clone_clock;
+	MemoryBank::Page page {
+		stream->run.pmem + n * (PageSize() / 8), stream->run.addr + n * PageSize(),
+		PageSize(), stream->run.dirty };
+	if (zeroed && page.dirty) {
+		page_memzero(page.pmem);
+		page.dirty = false;
+	}
+	return page;
 }
-MemoryBank::Page vMemory::new_hugepage()
+MemoryBank::Page vMemory::new_hugepage(bool zeroed)
 {
-	return banks.get_available_bank(512u).get_next_page(512u);
+	return banks.get_available_bank(512u).get_next_page(512u, zeroed);
 }
 
 char* vMemory::get_writable_page(uint64_t addr, uint64_t flags, bool zeroes, bool dirty)
@@ -496,38 +671,120 @@ char* vMemory::get_writable_page(uint64_t addr, uint64_t flags, bool zeroes, boo
 	return writable_page.page;
 }
 
-char* vMemory::get_kernelpage_at(uint64_t addr) const
+bool vMemory::tlb_usable(uint64_t addr) const noexcept
+{
+	/* Remote memory can be shared between many VMs, and
+	   SMP vCPUs can access memory concurrently. A forkable
+	   master is read concurrently by its forks, so only forks
+	   and non-forkable VMs use their software TLB. */
+	return !this->smp_guards_enabled && !this->is_forkable_master() &&
+		!(machine.has_remote() && machine.is_foreign_address(addr));
+}
+char* vMemory::readable_page(uint64_t addr, uint8_t perm, bool use_tlb) const
 {
 	if (machine.has_remote() && machine.is_foreign_address(addr)) {
 		// When connected to a remote VM, we can access the remote kernel memory
-		return machine.remote().main_memory().get_kernelpage_at(addr);
+		return machine.remote().main_memory().readable_page(addr, perm, false);
+	}
+	use_tlb = use_tlb && this->tlb_usable(addr);
+	if (use_tlb) {
+		if (char* page = tlb.lookup(addr, perm); page != nullptr)
+			return page;
 	}
 #ifdef TINYKVM_ARCH_AMD64
-	constexpr uint64_t flags = PDE64_PRESENT;
-	return readable_page_at(*this, addr, flags);
+	const uint64_t flags = (perm == SoftTLB::KernelRead)
+		? PDE64_PRESENT : PDE64_PRESENT | PDE64_USER;
+	char* page = readable_page_at(*this, addr, flags);
 #else
 #error "Implement me!"
 #endif
+	if (use_tlb) {
+		/* User-readable pages are also kernel-readable */
+		tlb.insert(addr, page, (perm == SoftTLB::UserRead)
+			? SoftTLB::UserRead | SoftTLB::KernelRead : perm);
+	}
+	return page;
+}
+
+char* vMemory::get_kernelpage_at(uint64_t addr) const
+{
+	return readable_page(addr, SoftTLB::KernelRead, true);
 }
 
 char* vMemory::get_userpage_at(uint64_t addr) const
 {
-	if (machine.has_remote() && machine.is_foreign_address(addr)) {
-		// When connected to a remote VM, we can access the remote kernel memory
-		return machine.remote().main_memory().get_userpage_at(addr);
-	}
-#ifdef TINYKVM_ARCH_AMD64
-	constexpr uint64_t flags = PDE64_PRESENT | PDE64_USER;
-	return readable_page_at(*this, addr, flags);
-#else
-#error "Implement me!"
-#endif
+	return readable_page(addr, SoftTLB::UserRead, true);
 }
 
 std::vector<std::pair<uint64_t, uint64_t>> Machine::get_accessed_pages() const
 {
 	return tinykvm::get_accessed_pages(this->main_memory());
 }
+std::vector<uint64_t> Machine::get_written_pages() const
+{
+	return memory.cow_written_pages();
+}
+void Machine::set_cow_prefault_pages(std::vector<uint64_t> pages)
+{
+	if (this->is_forked()) {
+		throw MachineException("Pre-fault pages can only be set on a master VM");
+	}
+	for (auto& addr : pages)
+		addr &= ~uint64_t(PAGE_SIZE - 1);
+	std::sort(pages.begin(), pages.end());
+	pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+	memory.cow_prefault_pages = std::move(pages);
+}
+void Machine::set_page_table_template(std::vector<uint64_t> addresses)
+{
+	if (this->is_forked() || !this->is_forkable()) {
+		throw MachineException("Page table templates can only be made after prepare_copy_on_write()");
+	}
+	/* The top of the stack, the heap and the TLS are written to by
+	   nearly every request, so their page tables are always cloned. */
+	const uint64_t hot[] = {
+		this->registers().rsp, this->m_stack_address - 1,
+		this->m_heap_address, this->m_brk_address,
+		this->get_special_registers().fs.base
+	};
+	addresses.insert(addresses.end(), std::begin(hot), std::end(hot));
+	for (auto& addr : addresses)
+		addr &= ~uint64_t(PAGE_SIZE - 1);
+	std::sort(addresses.begin(), addresses.end());
+	addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+	if (!addresses.empty() && addresses.front() == 0)
+		addresses.erase(addresses.begin());
+	memory.pt_template.addresses = std::move(addresses);
+	build_page_table_template(this->memory, memory.pt_template);
+}
+void Machine::memory_pressure()
+{
+	memory.banks.pressure_handled();
+	if (m_memory_pressure) {
+		m_memory_pressure(*this, memory.banks.stats().used_pages * vMemory::PageSize());
+		return;
+	}
+	const int sig = memory.banks.pressure_signal();
+	if (sig > 0 && !this->sigaction(sig).is_unset()) {
+		this->signals().enter(this->vcpu, sig);
+	}
+}
+NumaStats Machine::numa_stats() const
+{
+	NumaStats stats;
+	stats.current_node = NUMA::current_node();
+	NUMA::count_pages(memory.ptr, memory.size, 2UL << 20, stats.main_memory_pages);
+	for (size_t node = 0; node < stats.main_memory_pages.size(); node++) {
+		if (stats.main_memory_pages[node] > 0 && (stats.main_memory_node < 0 ||
+			stats.main_memory_pages[node] > stats.main_memory_pages[stats.main_memory_node]))
+			stats.main_memory_node = node;
+	}
+	for (const auto& bank : memory.banks) {
+		NUMA::count_pages(bank.mem, bank.n_used * vMemory::PageSize(),
+			vMemory::PageSize(), stats.bank_pages);
+	}
+	return stats;
+}
 size_t Machine::banked_memory_pages() const noexcept
 {
 	size_t count = 0;
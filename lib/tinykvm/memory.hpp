@@ -1,8 +1,14 @@
 #pragma once
 #include "common.hpp"
+#include "dirty_log.hpp"
+#include "hugepage_policy.hpp"
 #include "memory_bank.hpp"
+#include "numa.hpp"
+#include "physical_index.hpp"
+#include "soft_tlb.hpp"
 #include "virtual_mem.hpp"
 #include <cstddef>
+#include <memory>
 #include <mutex>
 #include <string_view>
 
@@ -10,6 +16,32 @@ namespace tinykvm {
 struct Machine;
 struct MemoryBanks;
 
+/* Outcome of deduplicating main memory in prepare_copy_on_write() */
+struct DedupResult {
+	size_t zero_pages = 0;      /* Zero 4K pages, no longer copied by forks */
+	size_t identical_pages = 0; /* 4K pages now sharing an identical page */
+	size_t released_bytes = 0;  /* Memory given back to the kernel */
+};
+
+/* Copies of the master page tables on the paths to the addresses forks
+   usually write to first (stack, heap, TLS), already made writable.
+   Forks install all of them with one copy instead of cloning each
+   table on its first write. See Machine::set_page_table_template(). */
+struct PageTableTemplate {
+	std::vector<uint64_t> addresses; /* Guest addresses covered */
+	std::vector<uint64_t> entries;   /* Page table pages, PML4 first */
+	std::vector<uint32_t> fixups;    /* Entries pointing into the template */
+	size_t pages() const noexcept { return entries.size() / 512; }
+};
+
+/* Time taken by the last prepare_copy_on_write(), in nanoseconds */
+struct PrepareStats {
+	uint64_t dedup_ns = 0;   /* Deduplicating pages, when enabled */
+	uint64_t makecow_ns = 0; /* Making the page tables copy-on-write */
+	uint64_t total_ns = 0;
+	unsigned threads = 1;    /* Threads walking the page tables */
+};
+
 struct vMemory {
 	static constexpr uint64_t MMAP_PHYS_BASE = 0x4000000000;
 	static constexpr uint64_t PageSize() {
@@ -17,13 +49,20 @@ struct vMemory {
 	}
 
 	Machine& machine;
-	std::vector<uint64_t> cow_written_pages{};
+	/* Pages forks of this VM copy-on-write up front, sorted */
+	std::vector<uint64_t> cow_prefault_pages{};
 	uint64_t physbase;
 	uint64_t safebase;
 	uint64_t page_tables;
 	/* Counter for the number of pages that have been unlocked
 	   in the main memory. */
 	size_t unlocked_pages = 0;
+	/* Entries unlocked for direct writes since the last commit,
+	   see Machine::commit_master_changes(). */
+	std::vector<uint64_t*> unlocked_entries;
+	/* Bumped by each master commit. Forks remember the generation
+	   of their master, and do a full reset when it has changed. */
+	uint32_t master_generation = 0;
 	/* Linear memory */
 	char*  ptr;
 	size_t size;
@@ -37,10 +76,31 @@ struct vMemory {
 	bool   main_memory_writes = false;
 	/* Split into small pages (4K) when reaching a leaf hugepage. */
 	bool   split_hugepages = true;
+	/* Per-region split policy, overriding split_hugepages when enabled */
+	std::unique_ptr<HugepagePolicy> hugepage_policy;
+	/* Bank pages reserved for sequential clones, see new_clone_page() */
+	uint16_t clone_ahead_pages = 0;
+	/* Deduplicate main memory pages in prepare_copy_on_write() */
+	bool   dedup_zero_pages = false;
+	bool   dedup_identical_pages = false;
+	DedupResult dedup_result;
+	/* Threads walking the page tables in prepare_copy_on_write() */
+	uint16_t prepare_threads = 1;
+	PrepareStats prepare_stats;
+	/* Page tables installed by forks of this VM, when not empty */
+	PageTableTemplate pt_template;
+	/* The master template was installed by the last fork or full reset */
+	bool pt_template_installed = false;
 	/* Executable heap */
 	bool   executable_heap = false;
 	/* Enable file-backed memory mappings for large files */
 	bool   mmap_backed_files = true;
+	/* Dirty page log of main memory, when enabled */
+	std::unique_ptr<DirtyLog> dirty_log;
+	/* Per-node copies of main memory, for forks on other nodes */
+	std::unique_ptr<NumaReplicas> numa_replicas;
+	/* Physical lookup of memory banks and mmap ranges */
+	PhysicalIndex phys_index;
 	/* Dynamic page memory */
 	MemoryBanks banks; // fault-in memory banks
 	/* mmap-ranges */
@@ -51,6 +111,9 @@ struct vMemory {
 	/* SMP mutex */
 	std::mutex mtx_smp;
 	bool smp_guards_enabled = false;
+	/* Software TLB for host-side accesses. Not used with SMP, or
+	   by forkable masters. Invalidated by the page table helpers. */
+	mutable SoftTLB tlb;
 
 	/* Unsafe */
 	bool within(uint64_t addr, size_t asize) const noexcept {
@@ -69,11 +132,40 @@ struct vMemory {
 
 	char *get_userpage_at(uint64_t addr) const;
 	char *get_kernelpage_at(uint64_t addr) const;
+	/* Record a host write to main memory in the dirty log */
+	void record_host_write(const void* host, size_t len) noexcept {
+		if (dirty_log != nullptr)
+			dirty_log->record((const char*)host - this->ptr, len);
+	}
+	/* The software TLB can be used for this (non-foreign) address */
+	bool tlb_usable(uint64_t addr) const noexcept;
+	/* Install a new page table root */
+	void set_page_tables(uint64_t root) noexcept {
+		this->page_tables = root;
+		this->tlb.invalidate();
+	}
+	/* Split (or clone whole) the copy-on-write hugepage at addr */
+	bool split_hugepage_at(uint64_t addr) const noexcept {
+		if (hugepage_policy != nullptr)
+			return !hugepage_policy->clone_whole(addr);
+		return split_hugepages;
+	}
 	char *get_writable_page(uint64_t addr, uint64_t flags, bool zeroes, bool dirty);
-	MemoryBank::Page new_page();
-	MemoryBank::Page new_hugepage();
+	MemoryBank::Page new_page(bool zeroed = false);
+	MemoryBank::Page new_hugepage(bool zeroed = false);
+	/* Up to n_pages contiguous pages from a single bank, at least one */
+	MemoryBank::Page new_pages(size_t n_pages, bool zeroed = false, bool ahead = false);
+	/* Give back the pages after the first used ones of a run from
+	   new_pages(), when nothing was handed out from its bank since. */
+	void give_back_pages(const MemoryBank::Page& run, size_t used) noexcept;
+	/* A page for a copy-on-write clone of the guest page at vaddr.
+	   With clone-ahead, the page follows the one handed out for
+	   vaddr - 4K, when there is room left in its reserved run. */
+	MemoryBank::Page new_clone_page(uint64_t vaddr, bool zeroed = false);
 
-	bool compare(const vMemory& other);
+	bool compare(const vMemory& other) const;
+	/* This fork reads a retired copy of the master main memory */
+	bool stale_numa_replica(const vMemory& other) const noexcept;
 	/* When a main VM has direct memory writes enabled, it can
 	   write directly to its own memory, but in order to constrain
 	   the memory usage, we need to keep track of the number of
@@ -86,7 +178,15 @@ struct vMemory {
 	VirtualMem vmem() const;
 
 	[[noreturn]] static void memory_exception(const char*, uint64_t, uint64_t, bool oom = false);
-	void record_cow_leaf_user_page(uint64_t addr);
+	/* Record a copy-on-write user page at addr, to be restored from
+	   source in fork_reset. The new page is the one pte points at. */
+	void record_cow_leaf_user_page(uint64_t addr, uint64_t* pte, uint64_t source, size_t size);
+	/* The sorted user pages recorded since the last full reset */
+	std::vector<uint64_t> cow_written_pages() const;
+	/* Make the given user pages writable in one batch, cloning them
+	   into a run of bank pages reserved up front. Running out of
+	   working memory leaves the rest to page faults. */
+	void prefault_cow_pages(const std::vector<uint64_t>& pages);
 	bool fork_reset(const Machine&, const MachineOptions&); // Returns true if a full reset was done
 	void fork_reset(const vMemory& other, const MachineOptions&);
 	static vMemory New(Machine&, const MachineOptions&, uint64_t phys, uint64_t safe, size_t size);
@@ -122,10 +222,24 @@ struct vMemory {
 		return snapshot_fd != -1;
 	}
 private:
+	char* readable_page(uint64_t addr, uint8_t perm, bool use_tlb) const;
 	using AllocationResult = std::tuple<char*, size_t, int>;
 	static AllocationResult allocate_mapped_memory(const MachineOptions&, size_t size);
 	static AllocationResult allocate_filebacked_memory(const MachineOptions&, size_t size);
+	void reset_banks(const MachineOptions&);
+	void fold_hugepage_policy(const MachineOptions&);
+	void use_numa_replica(const vMemory& other);
 	std::vector<unsigned> m_bank_idx_free_list;
+	/* Clone-ahead runs of bank pages, one per sequential writer */
+	struct CloneStream {
+		uint64_t next_vaddr = 0;
+		MemoryBank::Page run {};
+		uint32_t used = 0;
+		uint32_t count = 0;
+		uint32_t last_use = 0;
+	};
+	std::array<CloneStream, 4> m_clone_streams {};
+	uint32_t m_clone_clock = 0;
 };
 
 }
@@ -2,7 +2,9 @@
 
 #include "common.hpp"
 #include "machine.hpp"
+#include "page_streaming.hpp"
 #include "virtual_mem.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <malloc.h>
@@ -10,12 +12,19 @@
 
 namespace tinykvm {
 static constexpr bool VERBOSE_MEMORY_BANK = false;
+static constexpr uintptr_t HUGEPAGE_SIZE = 2UL << 20;
 
 MemoryBanks::MemoryBanks(Machine& machine, const MachineOptions& options)
 	: m_machine { machine },
 	  m_arena_begin { ARENA_BASE_ADDRESS },
 	  m_arena_next { m_arena_begin },
-	  m_idx { FIRST_BANK_IDX }
+	  m_idx { FIRST_BANK_IDX },
+	  m_shared_pool { options.shared_bank_pool },
+	  m_numa_node { options.numa_node },
+	  m_numa_local { options.numa_local_banks },
+	  m_transparent_hugepages { options.transparent_hugepage_banks },
+	  m_soft_pages { uint32_t(options.soft_cow_mem / vMemory::PageSize()) },
+	  m_pressure_signal { options.soft_cow_mem_signal }
 {
 	if (options.vmem_base_address != 0 || options.dylink_address_hint >= 0x1000000000) {
 		this->m_arena_begin += 0x800000000;
@@ -53,17 +62,51 @@ void MemoryBanks::set_max_pages(size_t new_max, size_t new_hugepages)
 	m_mem.reserve(new_banks);
 }
 
-char* MemoryBanks::try_alloc(size_t N, bool try_hugepages)
+static char* alloc_hugepage_aligned(size_t size)
 {
+	/* Over-allocate, and trim down to a 2MB-aligned range */
+	char* ptr = (char*) mmap(NULL, size + HUGEPAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED)
+		return ptr;
+	char* aligned = (char*)((uintptr_t(ptr) + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1));
+	if (aligned != ptr)
+		munmap(ptr, aligned - ptr);
+	munmap(aligned + size, (ptr + HUGEPAGE_SIZE) - aligned);
+	return aligned;
+}
+static bool advise_hugepages(char* ptr, size_t size)
+{
+	if ((uintptr_t(ptr) | size) & (HUGEPAGE_SIZE - 1))
+		return false;
+	return madvise(ptr, size, MADV_HUGEPAGE) == 0;
+}
+
+char* MemoryBanks::try_alloc(size_t N, bool try_hugepages, MemoryBank::Backing& backing)
+{
+	const size_t size = N * vMemory::PageSize();
 	char* ptr = (char*)MAP_FAILED;
+	backing = MemoryBank::Backing::Pages;
 	if (try_hugepages && N == 512) {
-		ptr = (char*) mmap(NULL, N * vMemory::PageSize(), PROT_READ | PROT_WRITE,
+		ptr = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
 			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED)
+			backing = MemoryBank::Backing::HugeTLB;
+	}
+	if (ptr == MAP_FAILED && m_transparent_hugepages && size % HUGEPAGE_SIZE == 0) {
+		ptr = alloc_hugepage_aligned(size);
+		if (ptr != MAP_FAILED && advise_hugepages(ptr, size))
+			backing = MemoryBank::Backing::Transparent;
 	}
 	if (ptr == MAP_FAILED) {
-		return (char*) mmap(NULL, N * vMemory::PageSize(), PROT_READ | PROT_WRITE,
+		ptr = (char*) mmap(NULL, N * vMemory::PageSize(), PROT_READ | PROT_WRITE,
 			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
 	}
+	/* Place the bank before it is faulted in */
+	const int node = (m_numa_local) ? NUMA::current_node() : m_numa_node;
+	if (ptr != MAP_FAILED && node >= 0) {
+		NUMA::bind(ptr, N * vMemory::PageSize(), node, false);
+	}
 	return ptr;
 }
 
@@ -76,16 +119,36 @@ MemoryBank& MemoryBanks::allocate_new_bank(uint64_t addr, unsigned pages)
 	if (try_hugepages) {
 		pages = m_hugepage_pages;
 	}
-	char* mem = this->try_alloc(pages, try_hugepages);
+	/* Lease warm bank memory from the shared pool, if enabled. */
+	const bool poolable = m_shared_pool && !try_hugepages && pages == MemoryBank::N_PAGES;
+	uint32_t n_dirty = 0;
+	char* mem = nullptr;
+	auto backing = MemoryBank::Backing::Pages;
+	if (poolable) {
+		auto& pool = MemoryBankPool::global();
+		mem = pool.lease(n_dirty);
+		if (mem != nullptr && pool.is_hugetlb(mem))
+			backing = MemoryBank::Backing::HugeTLB;
+		else if (mem != nullptr && m_transparent_hugepages && advise_hugepages(mem, MemoryBankPool::BANK_SIZE))
+			backing = MemoryBank::Backing::Transparent;
+	}
+	if (mem == nullptr) {
+		mem = this->try_alloc(pages, try_hugepages, backing);
+	}
 	if (mem == nullptr) {
 		pages = 16;
-		mem = this->try_alloc(pages, false);
+		mem = this->try_alloc(pages, false, backing);
 		this->m_hugepage_pages = 0;
 	}
 
 	const size_t size = pages * vMemory::PageSize();
 	if (mem != nullptr) {
-		m_mem.emplace_back(*this, mem, addr, pages, m_idx);
+		auto& bank = m_mem.emplace_back(*this, mem, addr, pages, m_idx);
+		/* Pages written by the previous owner of a pooled bank */
+		bank.n_dirty = n_dirty;
+		std::fill_n(bank.m_page_gen.begin(), n_dirty, MemoryBank::GEN_FOREIGN);
+		bank.pooled = poolable && mem != (char*)MAP_FAILED;
+		bank.backing = backing;
 
 		VirtualMem vmem { addr, mem, size };
 		if constexpr (VERBOSE_MEMORY_BANK) {
@@ -93,11 +156,26 @@ MemoryBank& MemoryBanks::allocate_new_bank(uint64_t addr, unsigned pages)
 				m_mem.size(), m_idx, addr, pages, size >> 10);
 		}
 		m_machine.install_memory(m_idx++, vmem, false);
+		m_machine.main_memory().phys_index.insert(addr, mem, size);
+		/* Banks start 2MB-aligned in the arena, see bank_of() */
+		const uint64_t first = (addr - m_arena_begin) >> PhysicalIndex::FRAME_SHIFT;
+		const uint64_t last = (addr + size - 1 - m_arena_begin) >> PhysicalIndex::FRAME_SHIFT;
+		if (m_frame_banks.size() <= last)
+			m_frame_banks.resize(last + 1, 0);
+		std::fill(m_frame_banks.begin() + first, m_frame_banks.begin() + last + 1, uint16_t(m_mem.size()));
 
 		return m_mem.back();
 	}
 	throw MemoryException("Failed to allocate memory bank", 0, size);
 }
+MemoryBank* MemoryBanks::bank_of(uint64_t addr) noexcept
+{
+	const uint64_t frame = (addr - m_arena_begin) >> PhysicalIndex::FRAME_SHIFT;
+	if (addr < m_arena_begin || frame >= m_frame_banks.size() || m_frame_banks[frame] == 0)
+		return nullptr;
+	auto& bank = m_mem[m_frame_banks[frame] - 1];
+	return bank.within(addr, vMemory::PageSize()) ? &bank : nullptr;
+}
 MemoryBank& MemoryBanks::get_available_bank(size_t pages)
 {
 	if constexpr (VERBOSE_MEMORY_BANK) {
@@ -122,7 +200,8 @@ MemoryBank& MemoryBanks::get_available_bank(size_t pages)
 		}
 		auto& bank = this->allocate_new_bank(m_arena_next, MemoryBank::N_PAGES);
 		m_num_pages += bank.n_pages;
-		m_arena_next += bank.size();
+		/* Keep banks 2MB-aligned for the physical index */
+		m_arena_next += (bank.size() + PhysicalIndex::FRAME_MASK) & ~PhysicalIndex::FRAME_MASK;
 		return bank;
 	}
 	/* Find room but with possible fragmentation. */
@@ -135,6 +214,7 @@ MemoryBank& MemoryBanks::get_available_bank(size_t pages)
 					printf("Reusing bank (fragmented) slot=%u at 0x%lX with %zu/%u used pages\n",
 						bank.idx, bank.addr, n_used + pages, bank.n_pages);
 				}
+				this->add_used_pages(n_used - bank.n_used);
 				bank.n_used = n_used;
 				return bank;
 			}
@@ -151,26 +231,76 @@ void MemoryBanks::reset(const MachineOptions& options)
 {
 	/* New maximum pages total in banks. */
 	this->m_max_pages = options.max_cow_mem / vMemory::PageSize();
+	this->m_soft_pages = options.soft_cow_mem / vMemory::PageSize();
+	this->m_pressure_signal = options.soft_cow_mem_signal;
+	this->m_used_pages = 0;
+	this->m_ahead_pages = 0;
+	this->m_peak_pages = 0;
+	this->m_soft_crossed = false;
+	this->m_pressure_pending = false;
 
-	/* Free memory belonging to banks after the free limit. */
-	//size_t limit_pages = options.reset_free_work_mem / vMemory::PageSize();
+	/* Pages handed out from now on belong to a new generation. */
+	this->m_generation++;
+	if (UNLIKELY(m_generation == MemoryBank::GEN_FOREIGN))
+		this->m_generation = MemoryBank::GEN_CLEAN + 1;
 
-	/* Instead of removing the banks, give memory back to kernel */
-	for (size_t i = 1u; i < m_mem.size(); i++) {
-		/* WARNING: MADV_FREE *does not* immediately free, so use MADV_DONTNEED instead. */
-		if (m_mem[i].dirty_size() > 0)
-			madvise(m_mem[i].mem, m_mem[i].dirty_size(), MADV_DONTNEED);
-		m_mem[i].n_dirty = 0;
+	if (options.reset_lazy_zeroing || m_shared_pool) {
+		/* Keep dirty pages resident, and zero them lazily when they
+		   are handed out again. Only memory above the free limit is
+		   given back to the kernel. A zero limit means no limit. */
+		size_t limit_pages = options.reset_free_work_mem / vMemory::PageSize();
+		const bool unlimited = limit_pages == 0;
+		for (auto& bank : m_mem) {
+			if (unlimited || bank.n_dirty <= limit_pages) {
+				if (!unlimited) limit_pages -= bank.n_dirty;
+				continue;
+			}
+			bank.reclaim(limit_pages);
+			limit_pages = 0;
+		}
+	} else {
+		/* Instead of removing the banks, give memory back to kernel */
+		for (size_t i = 1u; i < m_mem.size(); i++) {
+			m_mem[i].reclaim(0);
+		}
 	}
 
 	/* Reset page usage for remaining banks */
 	for (auto& bank : m_mem) {
 		bank.n_used = 0;
+		bank.clear_written();
 	}
 }
 
+void MemoryBanks::begin_reset_window() noexcept
+{
+	this->m_peak_pages = m_used_pages - m_ahead_pages;
+	this->m_soft_crossed = false;
+	this->m_pressure_pending = false;
+	/* The kept pages may already be above the soft limit */
+	this->add_used_pages(0);
+}
+
+WorkMemoryStats MemoryBanks::stats() const noexcept
+{
+	return WorkMemoryStats {
+		.used_pages = size_t(m_used_pages - m_ahead_pages),
+		.peak_pages = m_peak_pages,
+		.soft_limit_pages = m_soft_pages,
+		.hard_limit_pages = m_max_pages,
+		.soft_limit_crossings = m_soft_crossings,
+		.banks = m_mem.size(),
+		.hugetlb_banks = size_t(std::count_if(m_mem.begin(), m_mem.end(),
+			[] (const MemoryBank& bank) { return bank.backing == MemoryBank::Backing::HugeTLB; })),
+		.thp_banks = size_t(std::count_if(m_mem.begin(), m_mem.end(),
+			[] (const MemoryBank& bank) { return bank.backing == MemoryBank::Backing::Transparent; })),
+		.ahead_pages = m_ahead_pages,
+	};
+}
+
 MemoryBank::MemoryBank(MemoryBanks& b, char* p, uint64_t a, uint32_t np, uint16_t x)
-	: mem(p), addr(a), n_pages(np), idx(x), banks(b)
+	: mem(p), addr(a), n_pages(np), idx(x), banks(b),
+	  m_page_gen(np, GEN_CLEAN)
 {
 	if constexpr (VERBOSE_MEMORY_BANK) {
 		printf("Created memory bank slot=%u at 0x%lX with %u pages (%zu KiB)\n",
@@ -179,6 +309,10 @@ MemoryBank::MemoryBank(MemoryBanks& b, char* p, uint64_t a, uint32_t np, uint16_
 }
 MemoryBank::~MemoryBank()
 {
+	if (this->pooled) {
+		MemoryBankPool::global().release(this->mem, this->n_dirty);
+		return;
+	}
 	munmap(this->mem, this->n_pages * vMemory::PageSize());
 }
 
@@ -191,19 +325,252 @@ bool MemoryBank::room_for(size_t pages) const noexcept {
 	}
 	return n_used + pages <= n_pages;
 }
-MemoryBank::Page MemoryBank::get_next_page(size_t pages)
+MemoryBank::Page MemoryBank::get_next_page(size_t pages, bool zeroed, bool ahead)
 {
 	assert(this->n_used + pages <= this->n_pages);
 	const uint64_t offset = vMemory::PageSize() * this->n_used;
-	const bool dirty = this->n_used < this->n_dirty;
+	const uint32_t generation = banks.m_generation;
+	bool dirty = false;
+	for (uint32_t i = this->n_used; i < this->n_used + pages; i++) {
+		assert(m_page_gen[i] != generation && "Page handed out twice in the same generation");
+		if (m_page_gen[i] != GEN_CLEAN) {
+			if (zeroed)
+				tinykvm::page_memzero((uint64_t *)&mem[i * vMemory::PageSize()]);
+			else
+				dirty = true;
+		}
+		m_page_gen[i] = generation;
+	}
 	this->n_used += pages;
 	this->n_dirty = std::max(this->n_used, this->n_dirty);
+	if (ahead)
+		banks.m_ahead_pages += pages;
+	banks.add_used_pages(pages);
 	return {(uint64_t *)&mem[offset], addr + offset, pages * vMemory::PageSize(), dirty};
 }
+bool MemoryBank::give_back(uint64_t paddr, size_t pages) noexcept
+{
+	const uint32_t first = (paddr - this->addr) / vMemory::PageSize();
+	if (first + pages != this->n_used)
+		return false;
+	/* Whether they were written before is no longer known, so they
+	   will be zeroed or copied over when handed out again. */
+	for (uint32_t i = first; i < this->n_used; i++)
+		m_page_gen[i] = GEN_FOREIGN;
+	this->n_used = first;
+	banks.m_used_pages -= pages;
+	return true;
+}
+void MemoryBank::reclaim(uint32_t from)
+{
+	if (from >= this->n_dirty)
+		return;
+	/* WARNING: MADV_FREE *does not* immediately free, so use MADV_DONTNEED instead.
+	   If the kernel refuses (eg. hugetlbfs and unaligned), the pages stay dirty. */
+	const size_t len = (this->n_dirty - from) * vMemory::PageSize();
+	if (madvise(&mem[from * vMemory::PageSize()], len, MADV_DONTNEED) == 0) {
+		std::fill(m_page_gen.begin() + from, m_page_gen.begin() + this->n_dirty, GEN_CLEAN);
+		this->n_dirty = from;
+	}
+}
+
+void MemoryBank::record_written(uint32_t page, const WrittenPage& written)
+{
+	assert(page < this->n_pages);
+	if (m_written.empty()) {
+		m_written.resize((this->n_pages + 63) / 64);
+		m_written_rmap.resize(this->n_pages);
+	}
+	uint64_t& word = m_written[page / 64];
+	const uint64_t bit = 1ULL << (page % 64);
+	if ((word & bit) == 0) {
+		word |= bit;
+		m_n_written++;
+	}
+	m_written_rmap[page] = written;
+}
+void MemoryBank::clear_written() noexcept
+{
+	if (m_n_written > 0) {
+		std::fill(m_written.begin(), m_written.end(), 0);
+		m_n_written = 0;
+	}
+}
 
 VirtualMem MemoryBank::to_vmem() const noexcept
 {
 	return VirtualMem {this->addr, this->mem, this->size()};
 }
 
+static_assert(MemoryBank::N_PAGES < vMemory::PageSize(),
+	"The dirty page count must fit in the low bits of a pooled bank");
+static constexpr uintptr_t POOL_DIRTY_MASK = vMemory::PageSize() - 1;
+
+MemoryBankPool& MemoryBankPool::global()
+{
+	static MemoryBankPool pool;
+	return pool;
+}
+MemoryBankPool::~MemoryBankPool()
+{
+	this->clear();
+}
+
+char* MemoryBankPool::lease(uint32_t& n_dirty) noexcept
+{
+	const size_t cap = this->capacity();
+	const size_t start = m_hint.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < cap; i++) {
+		const size_t idx = (start + cap - i) % cap;
+		auto& slot = m_slots[idx];
+		if (slot.load(std::memory_order_relaxed) == 0)
+			continue;
+		const uintptr_t value = slot.exchange(0, std::memory_order_acquire);
+		if (value != 0) {
+			m_hint.store(idx, std::memory_order_relaxed);
+			m_leased.fetch_add(1, std::memory_order_relaxed);
+			n_dirty = value & POOL_DIRTY_MASK;
+			return (char*)(value & ~POOL_DIRTY_MASK);
+		}
+	}
+	m_missed.fetch_add(1, std::memory_order_relaxed);
+	return nullptr;
+}
+
+void MemoryBankPool::release(char* mem, uint32_t n_dirty) noexcept
+{
+	const uintptr_t value = uintptr_t(mem) | n_dirty;
+	const size_t cap = this->capacity();
+	const size_t start = m_hint.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < cap; i++) {
+		const size_t idx = (start + i) % cap;
+		auto& slot = m_slots[idx];
+		uintptr_t expected = 0;
+		if (slot.load(std::memory_order_relaxed) == 0 &&
+			slot.compare_exchange_strong(expected, value, std::memory_order_release))
+		{
+			m_hint.store(idx, std::memory_order_relaxed);
+			m_returned.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+	/* The pool is full */
+	m_unmapped.fetch_add(1, std::memory_order_relaxed);
+	this->unmap(mem);
+}
+
+void MemoryBankPool::set_capacity(size_t banks)
+{
+	if (banks > MAX_CAPACITY) {
+		throw MemoryException("Bank pool capacity too large", banks, MAX_CAPACITY);
+	}
+	m_capacity.store(banks, std::memory_order_relaxed);
+	m_hint.store(0, std::memory_order_relaxed);
+	/* Unmap banks that are now outside of the pool */
+	for (size_t i = banks; i < MAX_CAPACITY; i++) {
+		const uintptr_t value = m_slots[i].exchange(0, std::memory_order_acquire);
+		if (value != 0) {
+			this->unmap((char*)(value & ~POOL_DIRTY_MASK));
+		}
+	}
+}
+
+void MemoryBankPool::clear() noexcept
+{
+	for (auto& slot : m_slots) {
+		const uintptr_t value = slot.exchange(0, std::memory_order_acquire);
+		if (value != 0) {
+			this->unmap((char*)(value & ~POOL_DIRTY_MASK));
+		}
+	}
+}
+
+size_t MemoryBankPool::reserve_hugepages(size_t banks)
+{
+	const size_t live = m_hugetlb_banks.load(std::memory_order_relaxed);
+	if (live != 0) {
+		throw MemoryException("Bank pool hugepages already reserved", live, banks);
+	}
+	const size_t pooled = this->stats().pooled;
+	banks = std::min(banks, MAX_CAPACITY - pooled);
+	if (banks == 0)
+		return 0;
+	/* Without MAP_NORESERVE the hugepages are reserved now,
+	   so that faulting them in later can not fail. */
+	const size_t size = banks * BANK_SIZE;
+	char* arena = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+	if (arena == MAP_FAILED) {
+		if constexpr (VERBOSE_MEMORY_BANK) {
+			fprintf(stderr, "Bank pool: Failed to reserve %zu MiB of hugepages\n", size >> 20);
+		}
+		return 0;
+	}
+	m_hugetlb_begin.store(uintptr_t(arena), std::memory_order_relaxed);
+	m_hugetlb_end.store(uintptr_t(arena) + size, std::memory_order_relaxed);
+	for (size_t i = 0; i < banks; i++) {
+		m_hugetlb_live[i / 64].fetch_or(1ul << (i % 64), std::memory_order_relaxed);
+	}
+	m_hugetlb_banks.store(banks, std::memory_order_relaxed);
+	if (this->capacity() < pooled + banks) {
+		this->set_capacity(pooled + banks);
+	}
+	for (size_t i = 0; i < banks; i++) {
+		this->release(arena + i * BANK_SIZE, 0);
+	}
+	/* These were never leased */
+	m_returned.fetch_sub(banks, std::memory_order_relaxed);
+	if constexpr (VERBOSE_MEMORY_BANK) {
+		printf("Bank pool: Reserved %zu MiB of hugepages for %zu banks\n", size >> 20, banks);
+	}
+	return banks;
+}
+
+MemoryBankPool::Stats MemoryBankPool::stats() const noexcept
+{
+	size_t pooled = 0;
+	for (auto& slot : m_slots) {
+		if (slot.load(std::memory_order_relaxed) != 0)
+			pooled++;
+	}
+	return Stats {
+		.leased   = m_leased.load(std::memory_order_relaxed),
+		.missed   = m_missed.load(std::memory_order_relaxed),
+		.returned = m_returned.load(std::memory_order_relaxed),
+		.unmapped = m_unmapped.load(std::memory_order_relaxed),
+		.pooled   = pooled,
+		.hugetlb  = m_hugetlb_banks.load(std::memory_order_relaxed),
+	};
+}
+
+long MemoryBankPool::hugetlb_index(const char* mem) const noexcept
+{
+	const uintptr_t addr = uintptr_t(mem);
+	const uintptr_t begin = m_hugetlb_begin.load(std::memory_order_relaxed);
+	if (addr < begin || addr >= m_hugetlb_end.load(std::memory_order_relaxed))
+		return -1;
+	return (addr - begin) / BANK_SIZE;
+}
+
+bool MemoryBankPool::is_hugetlb(const char* mem) const noexcept
+{
+	/* Memory mapped later at the address of an unmapped
+	   arena bank is not from the arena. */
+	const long idx = this->hugetlb_index(mem);
+	return idx >= 0 &&
+		(m_hugetlb_live[idx / 64].load(std::memory_order_relaxed) & (1ul << (idx % 64))) != 0;
+}
+
+void MemoryBankPool::unmap(char* mem) noexcept
+{
+	/* Forget the arena bank before its address can be reused */
+	const long idx = this->hugetlb_index(mem);
+	if (idx >= 0) {
+		const uint64_t bit = 1ul << (idx % 64);
+		if (m_hugetlb_live[idx / 64].fetch_and(~bit, std::memory_order_relaxed) & bit)
+			m_hugetlb_banks.fetch_sub(1, std::memory_order_relaxed);
+	}
+	munmap(mem, BANK_SIZE);
+}
+
 } // tinykvm
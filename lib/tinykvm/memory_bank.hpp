@@ -1,5 +1,7 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <vector>
 #include "common.hpp"
 #include "virtual_mem.hpp"
@@ -13,12 +15,27 @@ struct MemoryBank {
 	static constexpr unsigned N_PAGES = 4u * 512;
 	static constexpr unsigned N_HUGEPAGES = 512u;
 
+	/* Page generation for pages that were never written, or
+	   that have been given back to the kernel since. */
+	static constexpr uint32_t GEN_CLEAN = 0;
+	/* Page generation for pages written by a previous owner. */
+	static constexpr uint32_t GEN_FOREIGN = UINT32_MAX;
+
 	char*    mem;
 	uint64_t addr;
 	uint32_t       n_used = 0;
+	/* High-water mark of pages that may be resident and dirty */
 	uint32_t       n_dirty = 0;
 	const uint32_t n_pages;
 	const uint16_t idx;
+	/* Memory is returned to the shared bank pool on destruction. */
+	bool pooled = false;
+	/* What backs the memory of this bank, as far as we know */
+	enum class Backing : uint8_t {
+		Pages,       /* Regular 4K pages */
+		Transparent, /* Advised to use transparent hugepages */
+		HugeTLB,     /* Explicit hugepages */
+	} backing = Backing::Pages;
 	MemoryBanks& banks;
 
 	bool within(uint64_t a, uint64_t s) const noexcept {
@@ -40,12 +57,138 @@ struct MemoryBank {
 		size_t    size;
 		bool      dirty;
 	};
-	Page get_next_page(size_t n_pages);
+	/* Hand out the next n_pages pages. When zeroed is true, any
+	   dirty pages are cleared here, and the result is never dirty.
+	   Pages taken ahead of their use only count as in use once
+	   MemoryBanks::use_ahead_page() is called for them. */
+	Page get_next_page(size_t n_pages, bool zeroed = false, bool ahead = false);
+	/* Take back the last n_pages pages handed out, starting at paddr.
+	   Returns false when other pages were handed out after them. */
+	bool give_back(uint64_t paddr, size_t n_pages) noexcept;
+	bool page_is_dirty(uint32_t page) const noexcept {
+		return m_page_gen[page] != GEN_CLEAN;
+	}
+	/* Give pages [from, n_dirty) back to the kernel. */
+	void reclaim(uint32_t from);
+
+	/* A copy-on-write user page written by a fork, which is
+	   restored from its source by reset_keep_all_work_memory. */
+	struct WrittenPage {
+		uint64_t  vaddr;  /* Guest virtual address */
+		uint64_t* pte;    /* Page table entry pointing at this page */
+		uint64_t  source; /* Guest physical address of the original */
+		uint32_t  pages;  /* 1, or 512 for a 2MB page */
+	};
+	void record_written(uint32_t page, const WrittenPage&);
+	void clear_written() noexcept;
+	uint32_t written_count() const noexcept { return m_n_written; }
+	/* Calls callback(page, WrittenPage) for each written page, in page order. */
+	template <typename Callback>
+	void foreach_written(Callback&& callback) const {
+		for (size_t w = 0; w < m_written.size() && m_n_written > 0; w++) {
+			for (uint64_t bits = m_written[w]; bits != 0; bits &= bits - 1) {
+				const uint32_t page = w * 64 + __builtin_ctzll(bits);
+				callback(page, m_written_rmap[page]);
+			}
+		}
+	}
 
 	VirtualMem to_vmem() const noexcept;
 
 	MemoryBank(MemoryBanks&, char*, uint64_t, uint32_t n, uint16_t idx);
 	~MemoryBank();
+private:
+	/* The generation each page was last handed out in */
+	std::vector<uint32_t> m_page_gen;
+	/* Written pages bitmap, and the reverse map for each page.
+	   Allocated on first use, as only forks record written pages. */
+	std::vector<uint64_t> m_written;
+	std::vector<WrittenPage> m_written_rmap;
+	uint32_t m_n_written = 0;
+	friend struct MemoryBanks;
+};
+
+/* Process-wide pool of bank memory. Banks of VMs that opt in with
+   MachineOptions::shared_bank_pool are returned here when the VM is
+   destroyed, and later leased by new VMs still mapped and warm. The
+   pool is a fixed array of slots, leased and returned with atomic
+   exchanges only. Each slot holds a page-aligned bank pointer with
+   the number of dirty pages in the low bits. */
+struct MemoryBankPool {
+	static constexpr size_t MAX_CAPACITY = 4096;
+	static constexpr size_t BANK_SIZE = MemoryBank::N_PAGES * 4096ul;
+
+	static MemoryBankPool& global();
+
+	/* Lease memory for a single bank. Returns nullptr when the pool
+	   is empty. n_dirty is set to the number of leading pages that
+	   may contain data from a previous owner. */
+	char* lease(uint32_t& n_dirty) noexcept;
+	/* Return bank memory to the pool. When the pool is full,
+	   the memory is unmapped instead. */
+	void release(char* mem, uint32_t n_dirty) noexcept;
+
+	/* Set the maximum number of pooled banks. Excess banks are unmapped. */
+	void set_capacity(size_t banks);
+	size_t capacity() const noexcept { return m_capacity.load(std::memory_order_relaxed); }
+	/* Unmap all pooled banks. */
+	void clear() noexcept;
+	/* Map one hugetlbfs-backed arena for the given number of banks
+	   up front, and add its banks to the pool, raising the capacity
+	   when needed, so that forks using the pool lease banks backed
+	   by hugepages. Can only be done again once every bank of the
+	   previous arena has been unmapped. Returns the number of banks
+	   added, which is 0 when the hugepages could not be reserved. */
+	size_t reserve_hugepages(size_t banks);
+	/* True if the bank memory is a live bank of the hugepage arena. */
+	bool is_hugetlb(const char* mem) const noexcept;
+
+	struct Stats {
+		uint64_t leased;   /* Leases served from the pool */
+		uint64_t missed;   /* Leases that found the pool empty */
+		uint64_t returned; /* Banks returned to the pool */
+		uint64_t unmapped; /* Banks unmapped because the pool was full */
+		size_t   pooled;   /* Banks currently in the pool */
+		size_t   hugetlb;  /* Live banks of the hugepage arena, pooled or leased */
+	};
+	Stats stats() const noexcept;
+
+private:
+	MemoryBankPool() = default;
+	~MemoryBankPool();
+
+	std::array<std::atomic<uintptr_t>, MAX_CAPACITY> m_slots {};
+	std::atomic<size_t> m_capacity = 256;
+	std::atomic<size_t> m_hint = 0;
+	std::atomic<uint64_t> m_leased = 0;
+	std::atomic<uint64_t> m_missed = 0;
+	std::atomic<uint64_t> m_returned = 0;
+	std::atomic<uint64_t> m_unmapped = 0;
+	/* Unmap bank memory that has left the pool for good. */
+	void unmap(char* mem) noexcept;
+	/* Index of the bank in the hugepage arena, or -1 */
+	long hugetlb_index(const char* mem) const noexcept;
+
+	/* The hugepage arena, see reserve_hugepages(). Arena banks can
+	   be unmapped one at a time, so the banks still mapped are kept
+	   in a bitmap, and counted. */
+	std::atomic<uintptr_t> m_hugetlb_begin = 0;
+	std::atomic<uintptr_t> m_hugetlb_end = 0;
+	std::array<std::atomic<uint64_t>, MAX_CAPACITY / 64> m_hugetlb_live {};
+	std::atomic<size_t> m_hugetlb_banks = 0;
+};
+
+/* Working memory usage of a VM, in pages. */
+struct WorkMemoryStats {
+	size_t used_pages;       /* Bank pages in use */
+	size_t peak_pages;       /* Most bank pages in use since the last reset */
+	size_t soft_limit_pages; /* MachineOptions::soft_cow_mem, or 0 */
+	size_t hard_limit_pages; /* MachineOptions::max_cow_mem */
+	uint64_t soft_limit_crossings; /* Resets in which the soft limit was crossed */
+	size_t banks;            /* Memory banks allocated */
+	size_t hugetlb_banks;    /* Banks backed by explicit hugepages */
+	size_t thp_banks;        /* Banks advised to use transparent hugepages */
+	size_t ahead_pages;      /* Bank pages taken for clone-ahead, not yet in use */
 };
 
 struct MemoryBanks {
@@ -64,6 +207,23 @@ struct MemoryBanks {
 		return m_idx++;
 	}
 
+	/* The current reset generation, starting at 1. */
+	uint32_t generation() const noexcept { return m_generation; }
+
+	/* True once the soft limit was crossed, until pressure_handled() */
+	bool pressure_pending() const noexcept { return m_pressure_pending; }
+	void pressure_handled() noexcept { m_pressure_pending = false; }
+	int pressure_signal() const noexcept { return m_pressure_signal; }
+	/* Start a new peak and soft limit window when pages are
+	   kept over a reset, see vMemory::fork_reset() */
+	void begin_reset_window() noexcept;
+	WorkMemoryStats stats() const noexcept;
+	/* A page taken ahead by get_next_page() is now in use */
+	void use_ahead_page() noexcept {
+		m_ahead_pages--;
+		this->add_used_pages(0);
+	}
+
 	bool using_hugepages() const noexcept { return m_hugepage_pages > 0; }
 	size_t banks_with_hugepages() const noexcept { return m_hugepage_pages / MemoryBank::N_PAGES; }
 
@@ -73,12 +233,27 @@ struct MemoryBanks {
 	auto end() const   { return m_mem.cend(); }
 	size_t size() const noexcept { return m_mem.size(); }
 	const MemoryBank& at(size_t i) const { return m_mem.at(i); }
+	/* Returns the bank containing the guest physical address, or nullptr.
+	   Looked up by the 2MB frame of the address in the arena. */
+	MemoryBank* bank_of(uint64_t addr) noexcept;
 
 private:
 	MemoryBank& allocate_new_bank(uint64_t addr, unsigned pages);
-	char* try_alloc(size_t N, bool try_hugepages);
+	char* try_alloc(size_t N, bool try_hugepages, MemoryBank::Backing&);
+	void add_used_pages(uint32_t pages) noexcept {
+		m_used_pages += pages;
+		const uint32_t in_use = m_used_pages - m_ahead_pages;
+		m_peak_pages = std::max(m_peak_pages, in_use);
+		if (UNLIKELY(in_use > m_soft_pages && m_soft_pages != 0 && !m_soft_crossed)) {
+			m_soft_crossed = true;
+			m_pressure_pending = true;
+			m_soft_crossings++;
+		}
+	}
 
 	std::vector<MemoryBank> m_mem;
+	/* Index + 1 into m_mem of the bank in each 2MB frame of the arena */
+	std::vector<uint16_t> m_frame_banks;
 	Machine& m_machine;
 	uint64_t m_arena_begin;
 	uint64_t m_arena_next;
@@ -88,6 +263,24 @@ private:
 	uint32_t m_num_pages = 0;
 	/* Max number of pages in all the banks */
 	uint32_t m_max_pages;
+	/* Lease and return bank memory through MemoryBankPool */
+	bool m_shared_pool = false;
+	/* Preferred NUMA node of new banks, and whether to
+	   use the node of the calling thread instead */
+	int  m_numa_node = -1;
+	bool m_numa_local = false;
+	/* Advise transparent hugepages for new banks */
+	bool m_transparent_hugepages = false;
+	uint32_t m_generation = 1;
+	/* Working memory accounting, see MachineOptions::soft_cow_mem */
+	uint32_t m_used_pages = 0;
+	uint32_t m_ahead_pages = 0; /* Part of m_used_pages not yet in use */
+	uint32_t m_peak_pages = 0;
+	uint32_t m_soft_pages = 0;
+	int  m_pressure_signal = 0;
+	bool m_soft_crossed = false;
+	bool m_pressure_pending = false;
+	uint64_t m_soft_crossings = 0;
 
 	friend struct MemoryBank;
 };
@@ -0,0 +1,177 @@
+#include "numa.hpp"
+
+#include "common.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace tinykvm {
+static constexpr bool VERBOSE_NUMA = false;
+static constexpr size_t NUMA_PAGE_SIZE = 4096;
+
+int NUMA::current_node() noexcept
+{
+	unsigned cpu = 0, node = 0;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0)
+		return -1;
+	return node;
+}
+
+bool NUMA::bind(void* addr, size_t len, int node, bool strict) noexcept
+{
+	if (node < 0 || unsigned(node) >= MAX_NODES)
+		return false;
+	const unsigned long nodemask = 1UL << node;
+	const int mode = (strict) ? MPOL_BIND : MPOL_PREFERRED;
+	if (syscall(SYS_mbind, addr, len, mode, &nodemask, MAX_NODES + 1, 0) < 0) {
+		if constexpr (VERBOSE_NUMA) {
+			fprintf(stderr, "NUMA: Failed to bind %p (%zu KiB) to node %d: %s\n",
+				addr, len >> 10, node, strerror(errno));
+		}
+		return false;
+	}
+	return true;
+}
+
+void NUMA::count_pages(const char* addr, size_t len, size_t stride,
+	std::vector<size_t>& per_node)
+{
+	static constexpr size_t BATCH = 512;
+	std::array<void*, BATCH> pages;
+	std::array<int, BATCH> status;
+	for (size_t off = 0; off < len; ) {
+		size_t count = 0;
+		for (; count < BATCH && off < len; count++, off += stride)
+			pages[count] = (void*)(addr + off);
+		/* With no target nodes, move_pages() only queries */
+		if (syscall(SYS_move_pages, 0, count, pages.data(), nullptr, status.data(), 0) < 0)
+			return;
+		for (size_t i = 0; i < count; i++) {
+			const int node = status[i];
+			if (node < 0) /* Not resident */
+				continue;
+			if (size_t(node) >= per_node.size())
+				per_node.resize(node + 1);
+			per_node[node]++;
+		}
+	}
+}
+
+/* Copy the pages of src that are present or swapped out, according
+   to /proc/self/pagemap, so that a sparse master does not make the
+   whole copy resident. Returns false if the pagemap is unavailable. */
+static bool copy_present_pages(char* dst, const char* src, size_t size)
+{
+	const int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	static constexpr uint64_t PM_PRESENT = 1ULL << 63;
+	static constexpr uint64_t PM_SWAPPED = 1ULL << 62;
+	static constexpr size_t BATCH = 512;
+	std::array<uint64_t, BATCH> entries;
+	const size_t n_pages = (size + NUMA_PAGE_SIZE - 1) / NUMA_PAGE_SIZE;
+	const off_t base = (uintptr_t(src) / NUMA_PAGE_SIZE) * sizeof(uint64_t);
+	size_t copied = 0;
+	for (size_t page = 0; page < n_pages; ) {
+		const size_t count = std::min(BATCH, n_pages - page);
+		const ssize_t len = count * sizeof(uint64_t);
+		if (pread(fd, entries.data(), len, base + page * sizeof(uint64_t)) != len) {
+			close(fd);
+			return false;
+		}
+		/* Copy runs of present pages at a time */
+		for (size_t i = 0; i < count; ) {
+			if ((entries[i] & (PM_PRESENT | PM_SWAPPED)) == 0) {
+				i++;
+				continue;
+			}
+			size_t end = i + 1;
+			while (end < count && (entries[end] & (PM_PRESENT | PM_SWAPPED)) != 0)
+				end++;
+			const size_t off = (page + i) * NUMA_PAGE_SIZE;
+			const size_t bytes = std::min(size, (page + end) * NUMA_PAGE_SIZE) - off;
+			std::memcpy(dst + off, src + off, bytes);
+			copied += end - i;
+			i = end;
+		}
+		page += count;
+	}
+	close(fd);
+	if constexpr (VERBOSE_NUMA) {
+		printf("NUMA: Copied %zu of %zu pages of main memory\n", copied, n_pages);
+	}
+	return true;
+}
+
+char* NumaReplicas::get(int node, const char* src, size_t size, bool anonymous)
+{
+	if (node < 0 || unsigned(node) >= NUMA::MAX_NODES || node == m_master_node)
+		return nullptr;
+	if (char* replica = m_replicas[node].load(std::memory_order_acquire); replica != nullptr)
+		return replica;
+
+	std::scoped_lock lock(m_mtx);
+	if (char* replica = m_replicas[node].load(std::memory_order_acquire); replica != nullptr)
+		return replica;
+	char* replica = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (replica == MAP_FAILED) {
+		throw MemoryException("Failed to allocate NUMA replica of main memory", 0, size);
+	}
+	NUMA::bind(replica, size, node, false);
+	if (!anonymous || !copy_present_pages(replica, src, size)) {
+		std::memcpy(replica, src, size);
+	}
+	if constexpr (VERBOSE_NUMA) {
+		printf("NUMA: Replicated main memory (%zu KiB) to node %d\n", size >> 10, node);
+	}
+	this->m_size = size;
+	m_replicas[node].store(replica, std::memory_order_release);
+	return replica;
+}
+
+bool NumaReplicas::is_current(const char* ptr) const noexcept
+{
+	for (const auto& replica : m_replicas) {
+		if (ptr != nullptr && replica.load(std::memory_order_relaxed) == ptr)
+			return true;
+	}
+	return false;
+}
+bool NumaReplicas::contains(const char* ptr) const noexcept
+{
+	if (this->is_current(ptr))
+		return true;
+	std::scoped_lock lock(m_mtx);
+	return ptr != nullptr &&
+		std::find(m_retired.begin(), m_retired.end(), ptr) != m_retired.end();
+}
+
+void NumaReplicas::invalidate()
+{
+	std::scoped_lock lock(m_mtx);
+	for (auto& replica : m_replicas) {
+		if (char* ptr = replica.exchange(nullptr, std::memory_order_acq_rel); ptr != nullptr) {
+			m_retired.push_back(ptr);
+			if constexpr (VERBOSE_NUMA) {
+				printf("NUMA: Retired a replica of main memory (%zu KiB)\n", m_size >> 10);
+			}
+		}
+	}
+}
+
+NumaReplicas::~NumaReplicas()
+{
+	for (auto& replica : m_replicas) {
+		if (char* ptr = replica.load(); ptr != nullptr)
+			munmap(ptr, m_size);
+	}
+	for (char* ptr : m_retired)
+		munmap(ptr, m_size);
+}
+
+} // tinykvm
@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace tinykvm {
+
+/* Minimal NUMA support using system calls directly, so that
+   there is no dependency on libnuma. */
+struct NUMA {
+	static constexpr unsigned MAX_NODES = 64;
+
+	/* The NUMA node of the calling thread, or -1 if unknown. */
+	static int current_node() noexcept;
+	/* Set the memory policy of [addr, addr+len) to the given node,
+	   either strictly (bind) or as a preference. Must be done before
+	   the memory is touched. Returns false on failure. */
+	static bool bind(void* addr, size_t len, int node, bool strict) noexcept;
+	/* Count resident pages per node in [addr, addr+len), looking
+	   at one page per stride. Counts are added to per_node. */
+	static void count_pages(const char* addr, size_t len, size_t stride,
+		std::vector<size_t>& per_node);
+};
+
+/* Per-node copies of the main memory of a master VM, which is
+   read-only once forks are being made. Forks running on another
+   node than the master memory is bound to will use the copy for
+   their node. Copies are made on first use, and live as long as
+   the master VM. Copies are retired whenever the master memory
+   changes, and forks move to a new copy on their next reset. */
+struct NumaReplicas {
+	NumaReplicas(int master_node) : m_master_node(master_node) {}
+	~NumaReplicas();
+
+	/* Returns the copy of [src, src+size) for the given node, or
+	   nullptr when the master memory should be used instead. When
+	   src is anonymous memory, only its present (or swapped) pages
+	   are copied, as the rest reads as zero in the copy too. */
+	char* get(int node, const char* src, size_t size, bool anonymous);
+	/* Returns true if ptr is the start of one of the copies,
+	   including retired copies still in use by forks. */
+	bool contains(const char* ptr) const noexcept;
+	/* Returns true if ptr is the start of a current copy. */
+	bool is_current(const char* ptr) const noexcept;
+	/* The master memory changed: retire the current copies. They
+	   are unmapped with the master, as forks may still use them. */
+	void invalidate();
+
+private:
+	const int m_master_node;
+	size_t m_size = 0;
+	mutable std::mutex m_mtx;
+	std::array<std::atomic<char*>, NUMA::MAX_NODES> m_replicas {};
+	std::vector<char*> m_retired;
+};
+
+struct NumaStats {
+	int current_node = -1;     /* Node of the calling thread */
+	int main_memory_node = -1; /* Node of the main memory (or its copy) used */
+	/* Resident main memory pages per node, sampled one page per 2MB */
+	std::vector<size_t> main_memory_pages;
+	/* Resident memory bank pages per node */
+	std::vector<size_t> bank_pages;
+};
+
+}
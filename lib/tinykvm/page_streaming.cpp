@@ -94,4 +94,25 @@ void avx2_page_dupliteit(uint64_t* dest, const uint64_t* source)
 	}
 }
 
+bool avx2_page_is_zeroed(const uint64_t* page)
+{
+	for (size_t i = 0; i < 16; i++) {
+		auto i0 = _mm256_load_si256((__m256i *)&page[4 * 0]);
+		auto i1 = _mm256_load_si256((__m256i *)&page[4 * 1]);
+		auto i2 = _mm256_load_si256((__m256i *)&page[4 * 2]);
+		auto i3 = _mm256_load_si256((__m256i *)&page[4 * 3]);
+		auto i4 = _mm256_load_si256((__m256i *)&page[4 * 4]);
+		auto i5 = _mm256_load_si256((__m256i *)&page[4 * 5]);
+		auto i6 = _mm256_load_si256((__m256i *)&page[4 * 6]);
+		auto i7 = _mm256_load_si256((__m256i *)&page[4 * 7]);
+		auto all = _mm256_or_si256(
+			_mm256_or_si256(_mm256_or_si256(i0, i1), _mm256_or_si256(i2, i3)),
+			_mm256_or_si256(_mm256_or_si256(i4, i5), _mm256_or_si256(i6, i7)));
+		if (!_mm256_testz_si256(all, all))
+			return false;
+		page += 4 * 8;
+	}
+	return true;
+}
+
 } // tinykvm
@@ -5,6 +5,7 @@
 namespace tinykvm {
 	extern void avx2_page_duplicate(uint64_t* dest, const uint64_t* source);
 	extern void avx2_page_dupliteit(uint64_t* dest, const uint64_t* source);
+	extern bool avx2_page_is_zeroed(const uint64_t* page);
 
 #ifdef ENABLE_AVX2_PAGE_UTILS
 	extern void page_duplicate(uint64_t* dest, const uint64_t* source);
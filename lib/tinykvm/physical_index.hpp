@@ -0,0 +1,49 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace tinykvm {
+
+/* Direct-indexed lookup from guest-physical addresses to host memory,
+   for memory regions outside of main memory (memory banks and mmap
+   ranges). Regions must start 2MB-aligned. Each 2MB frame is looked
+   up in a directory covering 1GB of physical memory, so a lookup is
+   always two loads, regardless of how many regions there are. */
+struct PhysicalIndex {
+	static constexpr unsigned FRAME_SHIFT = 21;
+	static constexpr unsigned DIR_SHIFT = 30;
+	static constexpr uint64_t FRAME_MASK = (1ULL << FRAME_SHIFT) - 1;
+
+	struct Frame {
+		char*    host = nullptr; /* Host address of the start of the frame */
+		uint64_t end  = 0;       /* Physical end of the region */
+	};
+
+	const Frame* find(uint64_t addr) const noexcept {
+		const uint64_t dir = addr >> DIR_SHIFT;
+		if (dir < m_dirs.size() && m_dirs[dir] != nullptr) {
+			const auto& frame = (*m_dirs[dir])[(addr >> FRAME_SHIFT) & 511];
+			if (frame.host != nullptr)
+				return &frame;
+		}
+		return nullptr;
+	}
+	/* Returns nullptr unless [addr, addr+size) is inside one region. */
+	char* at(uint64_t addr, uint64_t size) const noexcept {
+		const Frame* frame = find(addr);
+		if (frame != nullptr && addr + size <= frame->end && addr <= addr + size)
+			return frame->host + (addr & FRAME_MASK);
+		return nullptr;
+	}
+
+	void insert(uint64_t phys, char* host, uint64_t size);
+	void erase(uint64_t phys, uint64_t size);
+
+private:
+	using Directory = std::array<Frame, 512>;
+	std::vector<std::unique_ptr<Directory>> m_dirs;
+};
+
+}
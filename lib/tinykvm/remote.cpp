@@ -37,6 +37,7 @@ void Machine::remote_update_gigapage_mappings(Machine& remote, bool forced)
 		remote.memory.remote_must_update_gigapages = false;
 
 		auto& caller = *this;
+		caller.memory.tlb.invalidate();
 		const auto remote_vmem = remote.main_memory().vmem();
 		static constexpr uint64_t PDE64_ADDR_MASK = ~0x8000000000000FFF;
 		auto* main_pml4 = caller.main_memory().page_at(caller.main_memory().page_tables);
@@ -385,6 +386,7 @@ Machine::address_t Machine::remote_disconnect()
 	{
 		main_pdpt[i] = 0; // Clear entry
 	}
+	this->memory.tlb.invalidate();
 
 	// Restore original FSBASE
 	auto tls_base = this->vcpu.remote_original_tls_base;
@@ -0,0 +1,52 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+namespace tinykvm {
+
+/* A small direct-mapped software TLB for host-side guest memory
+   accesses (copy_to_guest, copy_from_guest, gather_buffers etc.),
+   caching the host page of a guest virtual page, and what it may be
+   used for. It must be invalidated whenever page tables change. */
+struct SoftTLB {
+	static constexpr unsigned ENTRIES = 64;
+	enum Permission : uint8_t {
+		KernelRead = 1,
+		UserRead   = 2,
+		UserWrite  = 4,
+	};
+
+	char* lookup(uint64_t vpage, uint8_t perm) const noexcept {
+		const Entry& entry = m_entries[(vpage >> 12) % ENTRIES];
+		if (entry.vpage == vpage && entry.generation == m_generation && (entry.perms & perm) != 0)
+			return entry.host;
+		return nullptr;
+	}
+	void insert(uint64_t vpage, char* host, uint8_t perms) noexcept {
+		Entry& entry = m_entries[(vpage >> 12) % ENTRIES];
+		if (entry.vpage == vpage && entry.generation == m_generation && entry.host == host) {
+			entry.perms |= perms;
+			return;
+		}
+		entry = Entry { vpage, host, m_generation, perms };
+	}
+	/* Invalidate all entries in O(1) by starting a new generation. */
+	void invalidate() noexcept {
+		if (++m_generation == 0) {
+			m_entries = {};
+			m_generation = 1;
+		}
+	}
+
+private:
+	struct Entry {
+		uint64_t vpage = 0;
+		char*    host  = nullptr;
+		uint32_t generation = 0;
+		uint8_t  perms = 0;
+	};
+	std::array<Entry, ENTRIES> m_entries {};
+	uint32_t m_generation = 1;
+};
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace tinykvm {
+
+/* Plain copy of a LatencyHistogram, which can be merged with
+   the snapshots of other machines (eg. many forks). */
+struct HistogramSnapshot {
+	static constexpr unsigned SUB_BITS = 3;
+	static constexpr unsigned SUB = 1u << SUB_BITS;
+	static constexpr unsigned BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+	std::array<uint64_t, BUCKETS> counts {};
+	uint64_t samples = 0;
+	uint64_t total = 0;
+	uint64_t min = UINT64_MAX;
+	uint64_t max = 0;
+
+	bool empty() const noexcept { return samples == 0; }
+	/* Value at the given percentile (0-100), within one sub-bucket */
+	uint64_t percentile(double p) const noexcept {
+		if (samples == 0) return 0;
+		uint64_t target = uint64_t(p / 100.0 * double(samples) + 0.5);
+		if (target == 0) target = 1;
+		uint64_t seen = 0;
+		for (unsigned i = 0; i < BUCKETS; i++) {
+			seen += counts[i];
+			if (seen >= target) {
+				const uint64_t value = midpoint(i);
+				return value < min ? min : (value > max ? max : value);
+			}
+		}
+		return max;
+	}
+	void merge(const HistogramSnapshot& other) noexcept {
+		for (unsigned i = 0; i < BUCKETS; i++)
+			counts[i] += other.counts[i];
+		samples += other.samples;
+		total += other.total;
+		if (other.min < min) min = other.min;
+		if (other.max > max) max = other.max;
+	}
+
+	/* Log-linear bucketing: SUB linear sub-buckets per power of two,
+	   so the relative error stays below 1/SUB for any magnitude. */
+	static unsigned bucket(uint64_t value) noexcept {
+		if (value < SUB) return value;
+		const unsigned shift = (63 - __builtin_clzll(value)) - SUB_BITS;
+		return (shift + 1) * SUB + ((value >> shift) & (SUB - 1));
+	}
+	static uint64_t midpoint(unsigned idx) noexcept {
+		if (idx < SUB) return idx;
+		const unsigned shift = idx / SUB - 1;
+		return (uint64_t(SUB + idx % SUB) << shift) + ((1ULL << shift) >> 1);
+	}
+};
+
+/* Fixed-size HDR-style histogram. Recording is lock-free and
+   allocation-free, and may happen from several vCPUs at once. */
+struct LatencyHistogram {
+	static constexpr unsigned BUCKETS = HistogramSnapshot::BUCKETS;
+
+	void record(uint64_t value) noexcept {
+		m_counts[HistogramSnapshot::bucket(value)].fetch_add(1, std::memory_order_relaxed);
+		m_total.fetch_add(value, std::memory_order_relaxed);
+		uint64_t cur = m_min.load(std::memory_order_relaxed);
+		while (value < cur && !m_min.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+		cur = m_max.load(std::memory_order_relaxed);
+		while (value > cur && !m_max.compare_exchange_weak(cur, value, std::memory_order_relaxed));
+	}
+
+	HistogramSnapshot snapshot() const noexcept {
+		HistogramSnapshot snap;
+		for (unsigned i = 0; i < BUCKETS; i++) {
+			snap.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+			snap.samples += snap.counts[i];
+		}
+		snap.total = m_total.load(std::memory_order_relaxed);
+		snap.min = m_min.load(std::memory_order_relaxed);
+		snap.max = m_max.load(std::memory_order_relaxed);
+		return snap;
+	}
+
+	void reset() noexcept {
+		for (auto& count : m_counts)
+			count.store(0, std::memory_order_relaxed);
+		m_total.store(0, std::memory_order_relaxed);
+		m_min.store(UINT64_MAX, std::memory_order_relaxed);
+		m_max.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	std::array<std::atomic<uint64_t>, BUCKETS> m_counts {};
+	std::atomic<uint64_t> m_total {0};
+	std::atomic<uint64_t> m_min {UINT64_MAX};
+	std::atomic<uint64_t> m_max {0};
+};
+
+} // namespace tinykvm
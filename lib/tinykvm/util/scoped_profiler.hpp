@@ -2,36 +2,71 @@
 
 #include <cstdint>
 #include <ctime>
-#include <cstring>
-#include <stdexcept>
-#include <vector>
+#include <x86intrin.h>
 #include "../common.hpp"
 
 namespace tinykvm {
 
+/* Profiling samples are measured in TSC ticks, which is much
+   cheaper than a clock_gettime() pair around every exit. */
+inline uint64_t profiling_ticks() noexcept {
+	return __rdtsc();
+}
+inline uint64_t time_ns() noexcept {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1'000'000'000ULL + uint64_t(ts.tv_nsec);
+}
+
 template <MachineProfiling::Location Which>
 struct ScopedProfiler {
 	ScopedProfiler(MachineProfiling* profiling) {
 		if (profiling) {
-			m_storage = &profiling->times.at(Which);
-			this->m_start_time = get_time_ns();
+			m_storage = &profiling->times[Which];
+			this->m_start_time = profiling_ticks();
 		}
 	}
+	/* Also record into the histogram of a system call number */
+	ScopedProfiler(MachineProfiling* profiling, unsigned scall)
+		: ScopedProfiler(profiling)
+	{
+		static_assert(Which == MachineProfiling::Syscall);
+		if (profiling)
+			m_detail = profiling->syscall(scall);
+	}
 
 	~ScopedProfiler() {
 		if (m_storage) {
-			const uint64_t end_time = get_time_ns();
-			m_storage->push_back(end_time - m_start_time);
+			const uint64_t ticks = profiling_ticks() - m_start_time;
+			m_storage->record(ticks);
+			if (m_detail)
+				m_detail->record(ticks);
 		}
 	}
 private:
-	static uint64_t get_time_ns() {
-		struct timespec ts;
-		clock_gettime(CLOCK_MONOTONIC, &ts);
-		return uint64_t(ts.tv_sec) * 1'000'000'000ULL + uint64_t(ts.tv_nsec);
+	LatencyHistogram* m_storage = nullptr;
+	LatencyHistogram* m_detail = nullptr;
+	uint64_t m_start_time = 0;
+};
+
+/* Records the host time spent handling a VM exit, by exit reason.
+   Nothing is recorded when no reason was set. */
+struct ScopedExitProfiler {
+	ScopedExitProfiler(MachineProfiling* profiling) : m_profiling(profiling) {
+		if (profiling)
+			this->m_start_time = profiling_ticks();
+	}
+	void set(MachineProfiling::Exit reason) noexcept {
+		this->m_reason = reason;
 	}
 
-	std::vector<uint64_t>* m_storage = nullptr;
+	~ScopedExitProfiler() {
+		if (m_profiling && m_reason != MachineProfiling::ExitCount)
+			m_profiling->exits[m_reason].record(profiling_ticks() - m_start_time);
+	}
+private:
+	MachineProfiling* m_profiling;
+	MachineProfiling::Exit m_reason = MachineProfiling::ExitCount;
 	uint64_t m_start_time = 0;
 };
 
@@ -11,6 +11,7 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 #include "page_streaming.hpp"
+#include "watchdog.hpp"
 #include "amd64/amd64.hpp"
 #include "amd64/idt.hpp"
 #include "amd64/gdt.hpp"
@@ -108,6 +109,11 @@ void vCPU::init(int id, Machine& machine, const MachineOptions& options)
 			Machine::machine_exception("KVM_SET_CPUID2 failed");
 		}
 	}
+	if (options.timeout_watchdog && this->watchdog == nullptr) {
+		this->watchdog = new WatchdogEntry;
+		this->watchdog->run = this->kvm_run;
+		Watchdog::global().add(this->watchdog);
+	}
 
 	// Only master VMs need special registers
 	// Forked VMs derive special register from the master VM
@@ -187,7 +193,9 @@ void vCPU::init(int id, Machine& machine, const MachineOptions& options)
 	msrs.entries[0].index = AMD64_MSR_STAR;
 	msrs.entries[1].index = AMD64_MSR_LSTAR;
 	msrs.entries[0].data  = (0x8LL << 32) | (0x1BLL << 48);
-	msrs.entries[1].data  = interrupt_header().translated_vm_syscall(machine.main_memory());
+	this->m_fastpath_allowed = options.syscall_fastpath;
+	this->m_fastpath_active = options.syscall_fastpath && !machine.is_multithreaded();
+	msrs.entries[1].data  = interrupt_header().translated_vm_syscall(machine.main_memory(), m_fastpath_active);
 
 	if (!this->machine().is_forked())
 	{
@@ -275,14 +283,22 @@ void vCPU::smp_init(int id, Machine& machine)
 
 void vCPU::deinit()
 {
+	/* Stop the watchdog and the timer from interrupting this vCPU
+	   first, as they write to kvm_run and signal its thread. The
+	   watchdog only kicks entries while holding its lock. */
+	if (this->watchdog != nullptr) {
+		Watchdog::global().remove(this->watchdog);
+		delete this->watchdog;
+		this->watchdog = nullptr;
+	}
+	timer_delete(this->timer_id);
+
 	if (this->fd > 0) {
 		close(this->fd);
 	}
 	if (kvm_run != nullptr) {
 		munmap(kvm_run, vcpu_mmap_size);
 	}
-
-	timer_delete(this->timer_id);
 }
 
 const tinykvm_x86regs& vCPU::registers() const
@@ -364,6 +380,7 @@ void Machine::setup_long_mode(const MachineOptions& options)
 	setup_amd64_exceptions(
 		physbase + INTR_ASM_ADDR,
 		memory.at(physbase + IDT_ADDR), memory.at(physbase + INTR_ASM_ADDR));
+	setup_interrupt_fastpath(memory.at(physbase + INTR_ASM_ADDR), this->max_address());
 	setup_amd64_segments(
 		physbase + GDT_ADDR,
 		memory.at(physbase + GDT_ADDR));
@@ -402,6 +419,38 @@ uint64_t vCPU::vcpu_table_addr() const noexcept
 	return usercode_header().translated_vm_cpuid(machine().memory)
 		+ sizeof(PerVCPUTable) * this->cpu_id;
 }
+void vCPU::update_syscall_fastpath()
+{
+	/* Threads give gettid() and sched_yield() other results, so
+	   VMs with threads enter system calls past the fast path, until
+	   the main thread is alone again. */
+	const bool active = m_fastpath_allowed && !machine().is_multithreaded();
+	if (active == m_fastpath_active)
+		return;
+	struct {
+		__u32 nmsrs;
+		__u32 pad = 0;
+		struct kvm_msr_entry entries[1];
+	} msrs;
+	msrs.nmsrs = 1;
+	msrs.entries[0].index = AMD64_MSR_LSTAR;
+	msrs.entries[0].data  = interrupt_header().translated_vm_syscall(machine().main_memory(), active);
+	if (ioctl(this->fd, KVM_SET_MSRS, &msrs) < (int)msrs.nmsrs) {
+		Machine::machine_exception("KVM_SET_MSRS: failed to set LSTAR");
+	}
+	this->m_fastpath_active = active;
+}
+
+void Machine::install_syscall_fastpath(unsigned idx, int64_t result)
+{
+	if (!set_interrupt_fastpath(idx, iasm_fastpath::Result, result))
+		throw MachineException("Too many fast path system calls", IASM_FASTPATH_MAX);
+}
+void Machine::remove_syscall_fastpath(unsigned idx)
+{
+	remove_interrupt_fastpath(idx);
+}
+
 void vCPU::set_vcpu_table_at(unsigned index, int value)
 {
 	if (index >= 4)
@@ -415,9 +464,27 @@ void vCPU::set_vcpu_table_at(unsigned index, int value)
 	}
 }
 
+static uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1'000'000'000ULL + uint64_t(ts.tv_nsec);
+}
+
 void Machine::prepare_copy_on_write(size_t max_work_mem, uint64_t shared_memory_boundary)
 {
+	const uint64_t t0 = monotonic_ns();
+	auto& stats = memory.prepare_stats;
+	stats = {};
+	stats.threads = std::max(memory.prepare_threads, uint16_t(1));
 	this->m_prepped = true;
+	/* Main memory may have changed since an earlier prepare */
+	if (memory.numa_replicas != nullptr)
+		memory.numa_replicas->invalidate();
+	/* The template copies the page tables from before, and
+	   is rebuilt once they have been made copy-on-write. */
+	memory.pt_template.entries.clear();
+	memory.pt_template.fixups.clear();
 	if (max_work_mem == 0) {
 	}
 
@@ -427,6 +494,19 @@ void Machine::prepare_copy_on_write(size_t max_work_mem, uint64_t shared_memory_
 	if (shared_memory_boundary == 0)
 		shared_memory_boundary = UINT64_MAX;
 
+	/* Zero and identical pages must be found while the DIRTY
+	   bits still tell which pages have been written to. */
+	if (memory.dedup_zero_pages || memory.dedup_identical_pages) {
+		const bool identical = memory.dedup_identical_pages && !memory.main_memory_writes
+			&& !memory.has_snapshot_area() && memory.dirty_log == nullptr;
+		memory.dedup_result = foreach_page_dedup(this->memory,
+			kernel_end_address(), shared_memory_boundary, memory.dedup_zero_pages, identical);
+		/* The vCPU may have cached translations to the released pages */
+		if (memory.dedup_result.released_bytes > 0)
+			vcpu.set_special_registers(this->get_special_registers());
+		stats.dedup_ns = monotonic_ns() - t0;
+	}
+
 	// Visualizing the page tables after makecow should show that all
 	// relevant user-writable pages have been made read-only and cloneable
 	//print_pagetables(this->memory);
@@ -446,7 +526,7 @@ void Machine::prepare_copy_on_write(size_t max_work_mem, uint64_t shared_memory_
 		/* If there are previously banked pages, we need to
 		   flatten them into the main memory. */
 		/// XXX: Implement memory flattening
-		memory.page_tables = memory.physbase + PT_ADDR;
+		memory.set_page_tables(memory.physbase + PT_ADDR);
 		struct kvm_sregs sregs = this->get_special_registers();
 
 		/* Page table entry will be cloned at the start */
@@ -456,14 +536,45 @@ void Machine::prepare_copy_on_write(size_t max_work_mem, uint64_t shared_memory_
 		vcpu.set_special_registers(sregs);
 		this->enter_usermode();
 
-		foreach_page_makecow(this->memory, kernel_end_address(), shared_memory_boundary);
+		const uint64_t t1 = monotonic_ns();
+		foreach_page_makecow(this->memory, kernel_end_address(), shared_memory_boundary, stats.threads);
+		stats.makecow_ns = monotonic_ns() - t1;
+		if (!memory.pt_template.addresses.empty())
+			build_page_table_template(this->memory, memory.pt_template);
+		stats.total_ns = monotonic_ns() - t0;
 		return;
 	}
 
 	/* This call makes this VM usable after making every page in the
 	   page tables read-only, enabling memory through page faults. */
-	foreach_page_makecow(this->memory, kernel_end_address(), shared_memory_boundary);
+	const uint64_t t1 = monotonic_ns();
+	foreach_page_makecow(this->memory, kernel_end_address(), shared_memory_boundary, stats.threads);
+	stats.makecow_ns = monotonic_ns() - t1;
+	if (!memory.pt_template.addresses.empty())
+		build_page_table_template(this->memory, memory.pt_template);
 	this->setup_cow_mode(this);
+	stats.total_ns = monotonic_ns() - t0;
+}
+size_t Machine::commit_master_changes()
+{
+	if (UNLIKELY(!this->is_forkable())) {
+		throw MachineException("Only a prepared master VM can commit changes");
+	}
+	const size_t pages = memory.unlocked_pages;
+	foreach_unlocked_relock(this->memory);
+	memory.unlocked_pages = 0;
+	memory.main_memory_writes = false;
+	memory.master_generation++;
+	/* The copies of main memory are now stale */
+	if (memory.numa_replicas != nullptr)
+		memory.numa_replicas->invalidate();
+	/* The template has copies of the page tables from before */
+	if (memory.pt_template.pages() > 0) {
+		build_page_table_template(this->memory, memory.pt_template);
+	}
+	/* Writable translations may still be cached by the vCPU */
+	vcpu.set_special_registers(this->get_special_registers());
+	return pages;
 }
 void Machine::setup_cow_mode(const Machine* other)
 {
@@ -471,9 +582,15 @@ void Machine::setup_cow_mode(const Machine* other)
 	   directly in order to avoid duplicating the memory banked
 	   page tables that allow the master VM to execute code
 	   separately from its forks, while sharing a master page table. */
-	auto pml4 = memory.new_page();
-	tinykvm::page_duplicate(pml4.pmem, other->memory.page_at(other->memory.physbase + PT_ADDR));
-	memory.page_tables = pml4.addr;
+	const auto& pt_template = other->memory.pt_template;
+	memory.pt_template_installed = other != this && pt_template.pages() != 0
+		&& install_page_table_template(this->memory, pt_template);
+	if (!memory.pt_template_installed)
+	{
+		auto pml4 = memory.new_page();
+		tinykvm::page_duplicate(pml4.pmem, other->memory.page_at(other->memory.physbase + PT_ADDR));
+		memory.set_page_tables(pml4.addr);
+	}
 
 	/* Zero a new page for IST stack */
 	// XXX: This is not strictly necessary as we can
@@ -488,6 +605,12 @@ void Machine::setup_cow_mode(const Machine* other)
 	writable_page_at(memory, memory.physbase + IST_ADDR, PDE64_RW | PDE64_NX, ist_opts);
 	//writable_page_at(memory, memory.physbase + IST2_ADDR, PDE64_RW | PDE64_NX, ist_opts);
 
+	/* Copy-on-write the expected write set of the master VM in one
+	   batch, avoiding a page fault VM exit for each of the pages. */
+	if (other != this && !other->memory.cow_prefault_pages.empty()) {
+		memory.prefault_cow_pages(other->memory.cow_prefault_pages);
+	}
+
 	struct kvm_sregs sregs = other->get_special_registers();
 
 	/* Page table entry will be cloned at the start */
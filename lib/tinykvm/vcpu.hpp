@@ -1,11 +1,14 @@
 #pragma once
 #include "common.hpp"
 #include "forward.hpp"
+#include <atomic>
 #include <mutex>
+#include <pthread.h>
 
 namespace tinykvm
 {
 	struct Machine;
+	struct WatchdogEntry;
 
 	struct vCPU
 	{
@@ -24,6 +27,9 @@ namespace tinykvm
 		void run(uint32_t tix);
 		long run_once();
 		void stop() { stopped = true; }
+		/* Cancel the call in progress from any thread. Returns false
+		   when there is none. The call ends with a timeout exception. */
+		bool request_stop_async();
 		void disable_timer();
 		std::string_view io_data() const;
 
@@ -45,6 +51,8 @@ namespace tinykvm
 		Machine* original_machine() const { return this->m_original_machine; }
 
 		void set_vcpu_table_at(unsigned index, int value);
+		/* Enter system calls through the fast path when allowed */
+		void update_syscall_fastpath();
 		bool timed_out() const;
 
 		int fd = -1;
@@ -54,6 +62,8 @@ namespace tinykvm
 		uint8_t current_exception = 0;
 		uint32_t timer_ticks = 0;
 		void* timer_id = nullptr;
+		/* Set when timeouts are enforced by the Watchdog instead */
+		WatchdogEntry* watchdog = nullptr;
 		uint64_t last_fault_address = 0;
 		uint64_t remote_return_address = 0;
 		uint64_t remote_original_tls_base = 0;
@@ -63,8 +73,18 @@ namespace tinykvm
 		struct kvm_run* kvm_run = nullptr;
 		Machine* m_machine = nullptr;
 		Machine* m_original_machine = nullptr;
+		uint64_t m_deadline_ns = 0;
+		bool m_fastpath_allowed = false;
+		bool m_fastpath_active = false;
+		/* The thread in run(), to be kicked by request_stop_async() */
+		std::mutex m_kick_mtx;
+		pthread_t m_run_thread = 0;
+		std::atomic<bool> m_stop_requested = false;
 
 		uint64_t vcpu_table_addr() const noexcept;
+		bool stale_kick() const;
+		void set_run_thread(pthread_t);
+		[[noreturn]] void stop_requested_exception();
 	};
 
 } // namespace tinykvm
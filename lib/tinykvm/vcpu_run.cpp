@@ -6,6 +6,7 @@
 #include "amd64/memory_layout.hpp"
 #include "amd64/paging.hpp"
 #include "util/scoped_profiler.hpp"
+#include "watchdog.hpp"
 #include <linux/kvm.h>
 #include <sys/ioctl.h>
 #include <time.h>
@@ -37,16 +38,80 @@ bool vCPU::timed_out() const
 {
 	if (timer_was_triggered) {
 		timer_was_triggered = false;
-		return true;
+		return !stale_kick();
 	}
 	return false;
 }
+/* A timer or watchdog interruption may arrive just after the call it
+   was meant for has ended, or a kick from request_stop_async() after
+   the cancelled call. Such a kick belongs to no call, and it is also
+   ignored before the deadline of the current one. */
+bool vCPU::stale_kick() const
+{
+	if (this->m_stop_requested.load())
+		return false;
+	if (this->timer_ticks != 0 && Watchdog::now_ns() >= this->m_deadline_ns)
+		return false;
+	if constexpr (VERBOSE_TIMER) {
+		printf("Timer %p: Ignored stale interruption\n", timer_id);
+	}
+	__atomic_store_n(&this->kvm_run->immediate_exit, 0, __ATOMIC_RELAXED);
+	return true;
+}
+
+bool vCPU::request_stop_async()
+{
+	std::scoped_lock lock(this->m_kick_mtx);
+	if (this->m_run_thread == 0)
+		return false;
+	/* KVM_RUN returns immediately when entered after this, and the
+	   signal interrupts it, or a blocking system call, if already in
+	   it. The request is checked again after each system call. */
+	this->m_stop_requested.store(true);
+	__atomic_store_n(&this->kvm_run->immediate_exit, 1, __ATOMIC_SEQ_CST);
+	pthread_kill(this->m_run_thread, SIGUSR2);
+	return true;
+}
+void vCPU::stop_requested_exception()
+{
+	this->m_stop_requested.store(false);
+	__atomic_store_n(&this->kvm_run->immediate_exit, 0, __ATOMIC_RELAXED);
+	timer_was_triggered = false;
+	Machine::timeout_exception("Execution cancelled (request_stop_async)", 0);
+}
+void vCPU::set_run_thread(pthread_t thread)
+{
+	std::scoped_lock lock(this->m_kick_mtx);
+	this->m_run_thread = thread;
+	this->m_stop_requested.store(false);
+	__atomic_store_n(&this->kvm_run->immediate_exit, 0, __ATOMIC_RELAXED);
+}
 
 void vCPU::run(uint32_t ticks)
 {
+	/* A run from inside a system call, eg. a remote call, stays
+	   within the timeout of the outer run and can be cancelled
+	   the same way. */
+	if (this->m_run_thread != 0 && ticks == 0) {
+		this->stopped = false;
+		while(run_once());
+		return;
+	}
+	const bool outermost = (this->m_run_thread == 0);
+	if (outermost)
+		this->set_run_thread(pthread_self());
+
 	timer_was_triggered = false;
 	this->timer_ticks = ticks;
-	if (timer_ticks != 0) {
+	if (ticks != 0)
+		this->m_deadline_ns = Watchdog::now_ns() + ticks * 1'000'000ULL;
+	if (this->watchdog != nullptr) {
+		if (timer_ticks != 0) {
+			/* No system calls: the watchdog thread only needs to be
+			   woken up when this deadline is earlier than its own. */
+			Watchdog::global().arm(*this->watchdog, this->m_deadline_ns);
+		}
+	} else if (timer_ticks != 0) {
 		const struct itimerspec its {
 			/* Interrupt every 20ms after timeout. This makes sure
 			   that we will eventually exit all blocking calls and
@@ -77,15 +142,22 @@ void vCPU::run(uint32_t ticks)
 		while(run_once());
 	} catch (...) {
 		disable_timer();
+		if (outermost)
+			this->set_run_thread(0);
 		throw;
 	}
 
 	disable_timer();
+	if (outermost)
+		this->set_run_thread(0);
 }
 void vCPU::disable_timer()
 {
 	timer_was_triggered = false;
-	if (timer_ticks != 0) {
+	if (this->watchdog != nullptr) {
+		this->timer_ticks = 0;
+		Watchdog::global().disarm(*this->watchdog);
+	} else if (timer_ticks != 0) {
 		this->timer_ticks = 0;
 		struct itimerspec its;
 		__builtin_memset(&its, 0, sizeof(its));
@@ -102,10 +174,19 @@ long vCPU::run_once()
 	{
 		ScopedProfiler<MachineProfiling::VCpuRun> prof(machine().profiling());
 		result = ioctl(this->fd, KVM_RUN, 0);
+		/* Kicks set immediate_exit before the signal */
+		while (UNLIKELY(result < 0 && errno == EINTR
+			&& (timer_was_triggered || kvm_run->immediate_exit) && stale_kick()))
+		{
+			timer_was_triggered = false;
+			result = ioctl(this->fd, KVM_RUN, 0);
+		}
 	}
 	// Handle potential KVM_RUN failure or execution timeout
 	if (UNLIKELY(result < 0)) {
-		if (this->timer_ticks) {
+		if (this->m_stop_requested.load()) {
+			stop_requested_exception();
+		} else if (this->timer_ticks) {
 			if constexpr (VERBOSE_TIMER) {
 				printf("Timer %p triggered\n", timer_id);
 			}
@@ -128,7 +209,9 @@ long vCPU::run_once()
 	} else if (this->timer_ticks) {
 		// Occasionally we miss timer interruptions, and we must catch it via TLS.
 		if (UNLIKELY(timer_was_triggered)) {
-			Machine::timeout_exception("Timeout Exception", this->timer_ticks);
+			if (!stale_kick())
+				Machine::timeout_exception("Timeout Exception", this->timer_ticks);
+			timer_was_triggered = false;
 		}
 	}
 
@@ -155,11 +238,13 @@ long vCPU::run_once()
 	}
 
 	// Handle the KVM guest exit reason
+	ScopedExitProfiler exit_prof(machine().profiling());
 	switch (kvm_run->exit_reason) {
 	case KVM_EXIT_HLT:
 		Machine::machine_exception("Halt from kernel space", KVM_EXIT_HLT);
 
 	case KVM_EXIT_DEBUG:
+		exit_prof.set(MachineProfiling::ExitDebug);
 		return KVM_EXIT_DEBUG;
 
 	case KVM_EXIT_FAIL_ENTRY:
@@ -173,8 +258,9 @@ long vCPU::run_once()
 		if (kvm_run->io.port == 0x0) {
 			const char* data = ((char *)kvm_run) + kvm_run->io.data_offset;
 			const uint32_t intr = *(uint32_t *)data;
+			exit_prof.set(MachineProfiling::ExitSyscall);
 			if (intr != 0xFFFF && intr != 0x1F778) {
-				ScopedProfiler<MachineProfiling::Syscall> prof(machine().profiling());
+				ScopedProfiler<MachineProfiling::Syscall> prof(machine().profiling(), intr);
 				static constexpr bool VERIFY_SYSCALL_REGS = false;
 				if constexpr (VERIFY_SYSCALL_REGS) {
 					auto regs_copy = this->registers();
@@ -212,7 +298,12 @@ long vCPU::run_once()
 				} else {
 					machine().system_call(*this, intr);
 				}
+				/* Deferred until the guest is in a system call */
+				if (UNLIKELY(machine().memory.banks.pressure_pending()))
+					machine().memory_pressure();
 				if (this->stopped) return 0;
+				if (UNLIKELY(this->m_stop_requested.load()))
+					stop_requested_exception();
 				if (this->timed_out()) {
 					Machine::timeout_exception("Timeout Exception", this->timer_ticks);
 				}
@@ -221,7 +312,7 @@ long vCPU::run_once()
 				this->stopped = true;
 				return 0;
 			} else if (intr == 0x1F778) {
-				// Remote VM disconnect syscall
+				// Remote VM disconnect syscall, profiled as a system call exit
 				if constexpr (VERBOSE_REMOTE) {
 					printf("Remote VM disconnect syscall, return=0x%lX\n",
 						this->remote_return_address);
@@ -252,6 +343,10 @@ long vCPU::run_once()
 				ScopedProfiler<MachineProfiling::PageFault> prof(machine().profiling());
 				auto& regs = registers();
 				const uint64_t addr = regs.rdi & ~(uint64_t) 0x8000000000000FFF;
+				/* The error code tells writes and instruction fetches apart */
+				exit_prof.set((regs.rax & 0x10) ? MachineProfiling::ExitPageFaultExec
+					: (regs.rax & 0x2) ? MachineProfiling::ExitPageFaultWrite
+					: MachineProfiling::ExitPageFaultRead);
 //#define VERBOSE_PAGE_FAULTS
 #ifdef VERBOSE_PAGE_FAULTS
 				char buffer[256];
@@ -281,6 +376,7 @@ long vCPU::run_once()
 					machine().remote_disconnect();
 					Machine::machine_exception("Kernel or zero page fault", intr);
 				} else if (machine().is_foreign_address(addr)) {
+					exit_prof.set(MachineProfiling::ExitRemote);
 					/* Check that the error code is instruction fetch failed */
 					const uint32_t errcode = regs.rax;
 					if constexpr (VERBOSE_REMOTE) {
@@ -380,18 +476,22 @@ long vCPU::run_once()
 			}
 			else if (intr == 1) /* Debug trap */
 			{
+				exit_prof.set(MachineProfiling::ExitDebug);
 				machine().m_on_breakpoint(*this);
 				return KVM_EXIT_IO;
 			}
 			/* CPU Exception */
+			exit_prof.set(MachineProfiling::ExitException);
 			this->handle_exception(intr);
 			Machine::machine_exception(amd64_exception_name(intr), intr);
 		} else {
+			exit_prof.set(MachineProfiling::ExitIO);
 			/* Custom Output handler */
 			const char* data = ((char *)kvm_run) + kvm_run->io.data_offset;
 			machine().m_on_output(*this, kvm_run->io.port, *(uint32_t *)data);
 		}
 		} else { // IN
+			exit_prof.set(MachineProfiling::ExitIO);
 			/* Custom Input handler */
 			const char* data = ((char *)kvm_run) + kvm_run->io.data_offset;
 			machine().m_on_input(*this, kvm_run->io.port, *(uint32_t *)data);
@@ -400,6 +500,7 @@ long vCPU::run_once()
 		return KVM_EXIT_IO;
 
 	case KVM_EXIT_MMIO: {
+			exit_prof.set(MachineProfiling::ExitMMIO);
 			const uint64_t addr = kvm_run->mmio.phys_addr;
 			char buffer[256];
 			PRINTER(machine().m_printer, buffer,
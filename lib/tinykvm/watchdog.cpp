@@ -0,0 +1,113 @@
+#include "watchdog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <linux/kvm.h>
+#include <signal.h>
+#include <time.h>
+
+namespace tinykvm {
+static constexpr bool VERBOSE_WATCHDOG = false;
+
+Watchdog& Watchdog::global()
+{
+	static Watchdog watchdog;
+	return watchdog;
+}
+uint64_t Watchdog::now_ns() noexcept
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec) * 1'000'000'000ULL + uint64_t(ts.tv_nsec);
+}
+
+Watchdog::~Watchdog()
+{
+	{
+		std::scoped_lock lock(m_mtx);
+		this->m_stop = true;
+		m_cond.notify_one();
+	}
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void Watchdog::add(WatchdogEntry* entry)
+{
+	std::scoped_lock lock(m_mtx);
+	m_entries.push_back(entry);
+	if (!m_thread.joinable()) {
+		m_thread = std::thread([this] { this->loop(); });
+	}
+}
+void Watchdog::remove(WatchdogEntry* entry)
+{
+	std::scoped_lock lock(m_mtx);
+	m_entries.erase(std::remove(m_entries.begin(), m_entries.end(), entry), m_entries.end());
+}
+
+void Watchdog::arm(WatchdogEntry& entry, uint64_t deadline_ns)
+{
+	entry.thread = pthread_self();
+	entry.deadline.store(deadline_ns);
+	/* The watchdog sees the new deadline on its next scan, unless it
+	   is going to sleep past it. A scan in progress (0) may have
+	   missed it, and a new scan is then made after it. */
+	const uint64_t next_wake = m_next_wake.load();
+	if (next_wake == 0 || deadline_ns < next_wake) {
+		std::scoped_lock lock(m_mtx);
+		m_cond.notify_one();
+	}
+}
+
+void Watchdog::loop()
+{
+	std::unique_lock lock(m_mtx);
+	while (!m_stop)
+	{
+		this->m_next_wake.store(0);
+		m_wakeups.fetch_add(1, std::memory_order_relaxed);
+		const uint64_t now = now_ns();
+		uint64_t next = UINT64_MAX;
+		for (auto* entry : m_entries) {
+			uint64_t deadline = entry->deadline.load();
+			if (deadline == 0)
+				continue;
+			if (deadline <= now) {
+				/* Only kick the call the deadline belongs to */
+				const uint64_t again = now + KICK_INTERVAL_NS;
+				if (entry->deadline.compare_exchange_strong(deadline, again)) {
+					entry->run->immediate_exit = 1;
+					pthread_kill(entry->thread, SIGUSR2);
+					m_kicks.fetch_add(1, std::memory_order_relaxed);
+					if constexpr (VERBOSE_WATCHDOG) {
+						printf("Watchdog: Interrupted vCPU thread %lu\n", entry->thread);
+					}
+					deadline = again;
+				} else if (deadline == 0) {
+					continue;
+				}
+			}
+			next = std::min(next, deadline);
+		}
+		this->m_next_wake.store(next);
+		if (next == UINT64_MAX) {
+			m_cond.wait(lock);
+		} else {
+			const auto until = std::chrono::steady_clock::time_point(std::chrono::nanoseconds(next));
+			m_cond.wait_until(lock, until);
+		}
+	}
+}
+
+Watchdog::Stats Watchdog::stats()
+{
+	std::scoped_lock lock(m_mtx);
+	return Stats {
+		.kicks   = m_kicks.load(std::memory_order_relaxed),
+		.wakeups = m_wakeups.load(std::memory_order_relaxed),
+		.entries = m_entries.size(),
+	};
+}
+
+} // tinykvm
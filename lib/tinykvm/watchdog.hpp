@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+struct kvm_run;
+
+namespace tinykvm {
+
+/* A vCPU watched by the Watchdog. The deadline is the next time
+   the vCPU is to be interrupted, or 0 when it's not running a
+   timed call. */
+struct WatchdogEntry {
+	std::atomic<uint64_t> deadline = 0;
+	pthread_t thread {};
+	struct kvm_run* run = nullptr;
+};
+
+/* One thread enforcing the execution timeouts of the vCPUs that use
+   it (see MachineOptions::timeout_watchdog), instead of a POSIX timer
+   being armed and disarmed with system calls around each timed call.
+   Arming and disarming are atomic stores, and the watchdog is only
+   woken up when a deadline is earlier than the one it sleeps until.
+   On expiry it sets immediate_exit and interrupts the vCPU thread
+   with SIGUSR2, repeating every 20ms until the call is over. */
+struct Watchdog {
+	static constexpr uint64_t KICK_INTERVAL_NS = 20'000'000ULL;
+
+	static Watchdog& global();
+	static uint64_t now_ns() noexcept;
+
+	void add(WatchdogEntry*);
+	void remove(WatchdogEntry*);
+	/* Arm the entry for the calling thread, with an absolute deadline. */
+	void arm(WatchdogEntry&, uint64_t deadline_ns);
+	void disarm(WatchdogEntry& entry) noexcept {
+		entry.deadline.store(0, std::memory_order_release);
+	}
+
+	struct Stats {
+		uint64_t kicks;   /* vCPU threads interrupted */
+		uint64_t wakeups; /* Times the watchdog thread woke up */
+		size_t   entries; /* vCPUs being watched */
+	};
+	Stats stats();
+
+private:
+	Watchdog() = default;
+	~Watchdog();
+	void loop();
+
+	std::mutex m_mtx;
+	std::condition_variable m_cond;
+	std::vector<WatchdogEntry*> m_entries;
+	std::thread m_thread;
+	bool m_stop = false;
+	/* When the watchdog wakes up next, or 0 while it's scanning */
+	std::atomic<uint64_t> m_next_wake = UINT64_MAX;
+	std::atomic<uint64_t> m_kicks = 0;
+	std::atomic<uint64_t> m_wakeups = 0;
+};
+
+} // tinykvm
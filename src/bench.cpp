@@ -377,6 +377,25 @@ int main(int argc, char** argv)
 	frtime /= NUM_RESETS;
 	frcall /= NUM_RESETS;
 
+	/* Minimal reset benchmark, skipping unused threads and fds */
+	tinykvm::MachineOptions minimal_options = options;
+	minimal_options.reset_minimal = true;
+	uint64_t mrtime = 0;
+	unsigned mrcount = 0;
+	for (unsigned i = 0; i < NUM_RESETS; i++)
+	{
+		/* Report how many resets actually took the minimal path */
+		mrcount += fvm.uses_no_subsystems(master_vm);
+		auto mrt0 = time_now();
+		asm("" : : : "memory");
+		fvm.reset_to(master_vm, minimal_options);
+		asm("" : : : "memory");
+		auto mrt1 = time_now();
+		fvm.timed_vmcall(vmcall_address, 4.0f);
+		mrtime += nanodiff(mrt0, mrt1);
+	}
+	mrtime /= NUM_RESETS;
+
 	auto nanos_per_gf = forktime / NUM_GUESTS;
 	auto nanos_per_fc = nanodiff(ft0, ft3) / NUM_GUESTS;
 	printf("VM fork: %ldns (%ld micros)\n", nanos_per_gf, nanos_per_gf / 1000);
@@ -393,6 +412,8 @@ int main(int argc, char** argv)
 
 	printf("Fast reset: %ldns (%ld micros)\n", frtime, frtime / 1000);
 	printf("Fast vmcall: %ldns (%ld micros)\n", frcall, frcall / 1000);
+	printf("Minimal reset: %ldns (%ld micros), %u/%u resets minimal\n",
+		mrtime, mrtime / 1000, mrcount, unsigned(NUM_RESETS));
 
 	// Benchmark alternating vmcalls on two different VMs
 	benchmark_alternate_tenant_vmcalls(master_vm, 500000);
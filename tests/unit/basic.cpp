@@ -1,4 +1,5 @@
 #include <catch2/catch_test_macros.hpp>
+#include <sys/syscall.h>
 
 #include <tinykvm/machine.hpp>
 extern std::vector<uint8_t> build_and_load(const std::string& code);
@@ -86,3 +87,101 @@ int main() {
 	// and the data matched 'Hello World!'.
 	REQUIRE(output_is_hello_world);
 }
+
+TEST_CASE("System calls answered inside the guest", "[Output]")
+{
+	const auto binary = build_and_load(R"M(
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+int main(int argc, char** argv) {
+	if (syscall(SYS_getuid) != 1234)
+		return 1;
+	if (syscall(SYS_gettid) != 1 || syscall(SYS_sched_yield) != 0)
+		return 2;
+	long set = 0;
+	if (syscall(SYS_rt_sigprocmask, SIG_BLOCK, 0, &set, 8) != 0 || set != -1)
+		return 3;
+	struct timeval tv;
+	if (syscall(SYS_gettimeofday, &tv, 0) != 0 || tv.tv_usec >= 1000000)
+		return 4;
+	const long t = syscall(SYS_time, 0);
+	const long host_time = atol(argv[1]);
+	if (t < host_time - 2 || t > host_time + 2 || tv.tv_sec < t - 1 || tv.tv_sec > t)
+		return 5;
+	return 666;
+})M");
+
+	// A pure system call registered by the embedder, which the
+	// regular getuid() handler would have answered with 0.
+	// The fast path table is process-wide, so always remove it again.
+	tinykvm::Machine::install_syscall_fastpath(SYS_getuid, 1234);
+	struct RemoveFastpath {
+		~RemoveFastpath() { tinykvm::Machine::remove_syscall_fastpath(SYS_getuid); }
+	} remove_fastpath;
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY, .syscall_fastpath = true } };
+	machine.setup_linux({"basic", std::to_string(time(nullptr))}, env);
+	machine.run(4.0f);
+
+	REQUIRE(machine.return_value() == 666);
+	// libc startup sets up the main thread, which keeps the fast path
+	REQUIRE(machine.has_threads());
+	REQUIRE(!machine.is_multithreaded());
+}
+
+TEST_CASE("Batch system calls with the syscall ring", "[Output]")
+{
+	const auto binary = build_and_load(R"M(
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+struct ring {
+	uint32_t sq_head, sq_tail, cq_head, cq_tail;
+	uint32_t entries, reserved[3];
+	struct { uint32_t scall, flags; uint64_t user_data, args[6]; } sq[8];
+	struct { uint64_t user_data; int64_t result; } cq[8];
+} ring;
+static const char* text[] = { "Hello ", "batched ", "World!" };
+
+int main() {
+	if (syscall(0x1F710, &ring, 8) != 0)
+		return 1;
+	for (int i = 0; i < 3; i++) {
+		ring.sq[i].scall = 1; /* write */
+		ring.sq[i].user_data = 100 + i;
+		ring.sq[i].args[0] = 1;
+		ring.sq[i].args[1] = (uintptr_t)text[i];
+		ring.sq[i].args[2] = strlen(text[i]);
+	}
+	ring.sq[3].scall = 60; /* exit is not allowed */
+	ring.sq[4].scall = 7;  /* poll may switch threads */
+	ring.sq_tail = 5;
+	if (syscall(0x1F711) != 5 || ring.sq_head != 5 || ring.cq_tail != 5)
+		return 2;
+	for (int i = 0; i < 3; i++) {
+		if (ring.cq[i].user_data != 100 + i || ring.cq[i].result != (int64_t)strlen(text[i]))
+			return 3;
+	}
+	if (ring.cq[3].result != -22 || ring.cq[4].result != -22)
+		return 4;
+	return 666;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"basic"}, env);
+	std::string output;
+	machine.set_printer([&] (const char* data, size_t size) {
+		output.append(data, size);
+	});
+	machine.run(4.0f);
+
+	REQUIRE(machine.return_value() == 666);
+	REQUIRE(output == "Hello batched World!");
+	REQUIRE(machine.syscall_ring().handled == 5);
+	REQUIRE(machine.syscall_ring().enters == 1);
+}
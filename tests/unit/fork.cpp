@@ -1,7 +1,10 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
 
+#include <tinykvm/fork_pool.hpp>
 #include <tinykvm/machine.hpp>
+#include <cstring>
+#include <sys/mman.h>
 extern std::vector<uint8_t> build_and_load(const std::string& code);
 static const uint64_t MAX_MEMORY = 8ul << 20; /* 8MB */
 static const uint64_t MAX_COWMEM = 3ul << 20; /* 1MB */
@@ -566,3 +569,750 @@ int func2() {
 		REQUIRE(fork2.return_value() == 22222);
 	}
 }
+
+TEST_CASE("Forks recycle banks through the shared bank pool", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	auto& pool = tinykvm::MemoryBankPool::global();
+	const auto before = pool.stats();
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+		.shared_bank_pool = true
+	};
+	{
+		tinykvm::Machine fork { machine, options };
+		fork.vmcall("get_value");
+		REQUIRE(fork.return_value() == 1);
+	}
+	const auto returned = pool.stats();
+	REQUIRE(returned.returned > before.returned);
+	REQUIRE(returned.pooled > 0);
+
+	// The next fork leases the warm bank, and must not see old data
+	for (int i = 0; i < 10; i++)
+	{
+		tinykvm::Machine fork { machine, options };
+		fork.vmcall("get_value");
+		REQUIRE(fork.return_value() == 1);
+
+		fork.reset_to(machine, options);
+		fork.vmcall("get_value");
+		REQUIRE(fork.return_value() == 1);
+	}
+	REQUIRE(pool.stats().leased > returned.leased);
+}
+
+TEST_CASE("Pre-fault the write set of a warm-up request", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM
+	};
+	// Record the write set of a warm-up request
+	tinykvm::Machine warmup { machine, options };
+	const auto cold_pages = warmup.banked_memory_pages();
+	warmup.vmcall("get_value");
+	REQUIRE(warmup.return_value() == 1);
+	const auto written = warmup.get_written_pages();
+	REQUIRE(!written.empty());
+
+	machine.set_cow_prefault_pages(written);
+	REQUIRE_THROWS(warmup.set_cow_prefault_pages(written));
+
+	// New forks start out with the write set already writable
+	tinykvm::Machine fork { machine, options };
+	REQUIRE(fork.banked_memory_pages() > cold_pages);
+	REQUIRE(fork.get_written_pages().size() >= written.size());
+	for (int i = 0; i < 10; i++)
+	{
+		fork.vmcall("get_value");
+		REQUIRE(fork.return_value() == 1);
+		fork.reset_to(machine, options);
+	}
+
+	// Errors other than running out of working memory are not hidden,
+	// here a kernel page that is not user-writable
+	machine.set_cow_prefault_pages({ 0x1000 });
+	REQUIRE_THROWS(tinykvm::Machine { machine, options });
+}
+
+TEST_CASE("Deduplicate zero and identical pages before forking", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+#include <string.h>
+static char zeroes[4][4096] __attribute__((aligned(4096)));
+char same[2][4096] __attribute__((aligned(4096)));
+int main() {
+	memset(same[0], 'A', sizeof(same[0]));
+	memset(same[1], 'A', sizeof(same[1]));
+	zeroes[0][0] = 1; zeroes[0][0] = 0;
+}
+extern int modify() {
+	same[1][0] = 'B';
+	zeroes[1][0] = 1;
+	return same[0][0] + same[1][0] + zeroes[0][0] + zeroes[1][0];
+}
+extern int sum() {
+	return same[0][4095] + same[1][4095] + zeroes[2][4095] + zeroes[3][0];
+})M");
+
+	tinykvm::Machine machine { binary, {
+		.max_mem = MAX_MEMORY,
+		.dedup_zero_pages = true,
+		.dedup_identical_pages = true,
+	} };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	const auto& stats = machine.dedup_stats();
+	REQUIRE(stats.zero_pages > 0);
+	REQUIRE(stats.identical_pages > 0);
+	REQUIRE(stats.released_bytes > 0);
+
+	// The master reads the deduplicated pages, not the released ones
+	machine.vmcall("sum");
+	REQUIRE(machine.return_value() == 'A' + 'A');
+	char same[2];
+	machine.copy_from_guest(&same[0], machine.address_of("same"), 1);
+	machine.copy_from_guest(&same[1], machine.address_of("same") + 4096, 1);
+	REQUIRE((same[0] == 'A' && same[1] == 'A'));
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM
+	};
+	for (int i = 0; i < 4; i++)
+	{
+		tinykvm::Machine fork { machine, options };
+		fork.vmcall("modify");
+		REQUIRE(fork.return_value() == 'A' + 'B' + 1);
+	}
+}
+
+TEST_CASE("Clone-ahead keeps sequential writes contiguous", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+static char buffer[64 * 4096] __attribute__((aligned(4096)));
+int main() {
+	buffer[0] = 1;
+}
+extern char* fill() {
+	for (unsigned i = 0; i < sizeof(buffer); i += 4096)
+		buffer[i] = 'A';
+	return buffer;
+}
+extern void touch() {
+	buffer[0] = 'B';
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+		.split_hugepages = true,
+		.clone_ahead_pages = 64,
+	};
+	tinykvm::Machine fork { machine, options };
+	for (int i = 0; i < 2; i++)
+	{
+		fork.vmcall("fill");
+		const auto addr = fork.return_value();
+		std::vector<tinykvm::Machine::Buffer> buffers;
+		fork.gather_buffers_from_range(buffers, addr, 64 * 4096);
+		REQUIRE(buffers.size() == 1);
+		REQUIRE(buffers.at(0).len == 64 * 4096);
+		fork.reset_to(machine, options);
+	}
+
+	// Reserved pages are not in use until a guest page is cloned into them
+	fork.vmcall("touch");
+	const auto stats = fork.work_memory_stats();
+	REQUIRE(stats.ahead_pages > 0);
+	REQUIRE(stats.used_pages < 64);
+}
+
+TEST_CASE("Reuse forks through a fork pool", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM
+	};
+	tinykvm::ForkPool pool { 2 };
+	pool.warmup(machine, options, 2);
+	REQUIRE(pool.size() == 2);
+
+	for (int i = 0; i < 10; i++)
+	{
+		auto fork = pool.acquire(machine, options);
+		REQUIRE(fork->is_fork_of(machine));
+		fork->vmcall("get_value");
+		REQUIRE(fork->return_value() == 1);
+		pool.release(std::move(fork));
+	}
+	const auto stats = pool.stats();
+	REQUIRE(stats.created == 2);
+	REQUIRE(stats.reused == 10);
+	REQUIRE(stats.pooled == 2);
+
+	// Forks reset in the background are handed out as they are
+	for (int i = 0; i < 10; i++)
+	{
+		auto fork = pool.acquire(machine, options);
+		fork->vmcall("get_value");
+		REQUIRE(fork->return_value() == 1);
+		pool.release_async(std::move(fork), machine, options);
+		pool.wait_for_resets();
+	}
+	REQUIRE(pool.stats().reset_async == 10);
+	REQUIRE(pool.stats().preset >= 9);
+
+	// Forks reset with other options are reset again
+	const auto preset = pool.stats().preset;
+	tinykvm::MachineOptions other_options = options;
+	other_options.reset_free_work_mem = 4096;
+	auto fork = pool.acquire(machine, other_options);
+	REQUIRE(pool.stats().preset == preset);
+	REQUIRE(fork->serial() != machine.serial());
+	fork->vmcall("get_value");
+	REQUIRE(fork->return_value() == 1);
+}
+
+TEST_CASE("Commit master changes to existing forks", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 1;
+extern void set_value(int v) {
+	value = v;
+}
+extern int get_value() {
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write(MAX_COWMEM);
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+		.reset_keep_all_work_memory = true,
+	};
+	tinykvm::Machine fork { machine, options };
+	fork.vmcall("get_value");
+	REQUIRE(fork.return_value() == 1);
+
+	// The master writes directly to main memory, then commits
+	machine.set_main_memory_writable(true);
+	machine.vmcall("set_value", 42);
+	REQUIRE(machine.commit_master_changes() > 0);
+	REQUIRE(machine.master_generation() == 1);
+
+	fork.reset_to(machine, options);
+	fork.vmcall("get_value");
+	REQUIRE(fork.return_value() == 42);
+
+	// Forks can be made again after a commit
+	tinykvm::Machine fork2 { machine, options };
+	fork2.vmcall("get_value");
+	REQUIRE(fork2.return_value() == 42);
+}
+
+TEST_CASE("Install page table templates in forks", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+	REQUIRE(machine.page_table_template_pages() == 0);
+	machine.set_page_table_template();
+	REQUIRE(machine.page_table_template_pages() > 0);
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM
+	};
+	tinykvm::Machine fork { machine, options };
+	REQUIRE(fork.installed_page_table_template());
+	for (int i = 0; i < 2; i++)
+	{
+		fork.vmcall("get_value");
+		REQUIRE(fork.return_value() == 1);
+		REQUIRE(fork.reset_to(machine, options));
+		REQUIRE(fork.installed_page_table_template());
+	}
+
+	// Preparing again rebuilds the template from the new page tables
+	machine.prepare_copy_on_write();
+	REQUIRE(machine.page_table_template_pages() > 0);
+	tinykvm::Machine fork2 { machine, options };
+	REQUIRE(fork2.installed_page_table_template());
+	fork2.vmcall("get_value");
+	REQUIRE(fork2.return_value() == 1);
+}
+
+TEST_CASE("Report memory pressure at the soft working memory limit", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+#include <stdio.h>
+static char buffer[256 * 4096] __attribute__((aligned(4096)));
+int main() {
+}
+extern void fill() {
+	for (unsigned i = 0; i < sizeof(buffer); i += 4096)
+		buffer[i] = 'A';
+	printf("Filled\n");
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+		.soft_cow_mem = 128 * 4096,
+	};
+	tinykvm::Machine fork { machine, options };
+	size_t pressure = 0;
+	fork.set_memory_pressure_handler([&] (tinykvm::Machine&, size_t used) {
+		pressure = used;
+	});
+	fork.set_printer([] (const char*, size_t) {});
+
+	fork.vmcall("fill");
+	REQUIRE(pressure > 128 * 4096);
+	REQUIRE(fork.work_memory_stats().peak_pages >= 256);
+	REQUIRE(fork.work_memory_stats().soft_limit_crossings == 1);
+
+	fork.reset_to(machine, options);
+	REQUIRE(fork.work_memory_stats().peak_pages < 128);
+
+	// Kept working memory is checked against the soft limit again on each reset
+	tinykvm::MachineOptions keep_options = options;
+	keep_options.reset_keep_all_work_memory = true;
+	tinykvm::Machine keeper { machine, keep_options };
+	size_t reports = 0;
+	keeper.set_memory_pressure_handler([&] (tinykvm::Machine&, size_t) {
+		reports++;
+	});
+	keeper.set_printer([] (const char*, size_t) {});
+
+	keeper.vmcall("fill");
+	REQUIRE(reports == 1);
+	REQUIRE(keeper.work_memory_stats().soft_limit_crossings == 1);
+
+	keeper.reset_to(machine, keep_options);
+	REQUIRE(keeper.work_memory_stats().used_pages >= 256);
+	REQUIRE(keeper.work_memory_stats().soft_limit_crossings == 2);
+	keeper.vmcall("fill");
+	REQUIRE(reports == 2);
+}
+
+TEST_CASE("Back memory banks with hugepages where possible", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	// The pool is process-wide: start empty, so that only arena
+	// banks can be leased, and leave it as it was found.
+	auto& pool = tinykvm::MemoryBankPool::global();
+	const size_t capacity = pool.capacity();
+	pool.clear();
+
+	// Explicit hugepages may not be available on this system
+	const size_t reserved = pool.reserve_hugepages(2);
+	REQUIRE(pool.stats().hugetlb == reserved);
+	{
+		const tinykvm::MachineOptions options {
+			.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+			.shared_bank_pool = true,
+			.transparent_hugepage_banks = true,
+		};
+		tinykvm::Machine fork { machine, options };
+		fork.vmcall("get_value");
+		REQUIRE(fork.return_value() == 1);
+
+		const auto stats = fork.work_memory_stats();
+		REQUIRE(stats.banks > 0);
+		if (reserved > 0) {
+			REQUIRE(stats.hugetlb_banks > 0);
+		}
+		REQUIRE(pool.stats().hugetlb == reserved);
+	}
+
+	// Unmapped arena banks are no longer counted, nor recognized
+	pool.clear();
+	REQUIRE(pool.stats().hugetlb == 0);
+	pool.set_capacity(capacity);
+	REQUIRE(pool.capacity() == capacity);
+}
+
+TEST_CASE("NUMA statistics and binding on the current node", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	// The kernel may have been built without NUMA support
+	const int node = tinykvm::NUMA::current_node();
+	const size_t size = 8ul << 20;
+	char* master = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	REQUIRE(master != MAP_FAILED);
+	if (node < 0 || !tinykvm::NUMA::bind(master, size, node, true)) {
+		munmap(master, size);
+		return;
+	}
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY, .numa_node = node } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	auto stats = machine.numa_stats();
+	REQUIRE(stats.current_node == node);
+	REQUIRE(stats.main_memory_node == node);
+	REQUIRE(stats.main_memory_pages.size() == size_t(node) + 1);
+
+	tinykvm::Machine fork { machine, {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+		.numa_node = node, .numa_local_banks = true,
+	} };
+	fork.vmcall("get_value");
+	REQUIRE(fork.return_value() == 1);
+	stats = fork.numa_stats();
+	REQUIRE(stats.main_memory_node == node);
+	REQUIRE(stats.bank_pages.size() == size_t(node) + 1);
+	REQUIRE(stats.bank_pages[node] > 0);
+
+	// A copy of sparse main memory only makes the written pages resident,
+	// or at most their 2MB pages with transparent hugepages
+	for (size_t off = 0; off < 4 * 4096; off += 4096)
+		master[off + 5] = 'M';
+	master[size - 1] = 'E';
+	tinykvm::NumaReplicas replicas { -1 };
+	const char* replica = replicas.get(node, master, size, true);
+	REQUIRE(replica != nullptr);
+	REQUIRE(replicas.contains(replica));
+	std::vector<size_t> resident;
+	tinykvm::NUMA::count_pages(replica, size, 4096, resident);
+	REQUIRE(resident.size() == size_t(node) + 1);
+	REQUIRE(resident[node] >= 5);
+	REQUIRE(resident[node] <= 2 * (2ul << 20) / 4096);
+	REQUIRE(std::memcmp(replica, master, size) == 0);
+
+	// A change to the master retires the copy, and the next one sees the change
+	master[4096 + 5] = 'N';
+	replicas.invalidate();
+	REQUIRE(replicas.contains(replica));
+	REQUIRE(!replicas.is_current(replica));
+	const char* renewed = replicas.get(node, master, size, true);
+	REQUIRE(renewed != nullptr);
+	REQUIRE(renewed != replica);
+	REQUIRE(replicas.is_current(renewed));
+	REQUIRE(renewed[4096 + 5] == 'N');
+	REQUIRE(replica[4096 + 5] == 'M');
+	munmap(master, size);
+}
+
+TEST_CASE("Adaptive hugepage copy-on-write decision", "[Fork]")
+{
+	using tinykvm::HugepagePolicy;
+	HugepagePolicy policy { 4 };
+	const uint64_t dense  = 0x40000000;
+	const uint64_t sparse = dense + (2ul << 20);
+	const auto reset_round = [&] (unsigned dense_writes, unsigned sparse_writes) {
+		for (unsigned i = 0; i < dense_writes; i++)
+			policy.record_write(dense + i * 4096);
+		for (unsigned i = 0; i < sparse_writes; i++)
+			policy.record_write(sparse + i * 4096);
+		policy.fold();
+	};
+
+	// Regions are split until their running average reaches the threshold
+	REQUIRE(!policy.clone_whole(dense));
+	reset_round(8, 1);
+	REQUIRE(!policy.clone_whole(dense));
+	reset_round(8, 1);
+	REQUIRE(!policy.clone_whole(dense));
+	reset_round(8, 1);
+	REQUIRE(policy.clone_whole(dense));
+	REQUIRE(policy.clone_whole(dense + 0x1FF000));
+	REQUIRE(!policy.clone_whole(sparse));
+	REQUIRE(!policy.clone_whole(0x0));
+	REQUIRE(policy.hot_regions() == 1);
+
+	// Hot regions are cloned whole, and split again once to resample them
+	for (unsigned i = 0; i < HugepagePolicy::RESAMPLE_ROUNDS - 1; i++) {
+		reset_round(0, 1);
+		REQUIRE(policy.clone_whole(dense));
+	}
+	reset_round(0, 1);
+	REQUIRE(!policy.clone_whole(dense));
+	REQUIRE(policy.hot_regions() == 0);
+
+	// A region still dense when resampled is hot again right away
+	reset_round(8, 1);
+	REQUIRE(policy.clone_whole(dense));
+
+	// A region that became sparse stays split
+	for (unsigned i = 0; i < HugepagePolicy::RESAMPLE_ROUNDS; i++)
+		reset_round(0, 1);
+	REQUIRE(!policy.clone_whole(dense));
+	reset_round(1, 1);
+	REQUIRE(!policy.clone_whole(dense));
+	REQUIRE(!policy.clone_whole(sparse));
+	REQUIRE(policy.hot_regions() == 0);
+
+	// The number of tracked regions is bounded, and cold regions are dropped
+	for (uint64_t i = 0; i < HugepagePolicy::MAX_REGIONS + 16; i++)
+		policy.record_write(i << HugepagePolicy::REGION_SHIFT);
+	REQUIRE(policy.regions() == HugepagePolicy::MAX_REGIONS);
+	for (unsigned i = 0; i < 32; i++)
+		policy.fold();
+	REQUIRE(policy.regions() == 0);
+}
+
+TEST_CASE("Adaptive hugepage copy-on-write clones dense regions whole", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+static char buffer[4u << 20] __attribute__((aligned(2u << 20)));
+int main() {
+	for (unsigned i = 0; i < sizeof(buffer); i += 4096)
+		buffer[i] = 1;
+}
+extern void touch(unsigned pages) {
+	char* region = (char *)(((unsigned long)buffer + (2ul << 20) - 1) & ~((2ul << 20) - 1));
+	for (unsigned i = 0; i < pages; i++)
+		region[i * 4096] = 2;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = 16ul << 20 } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write(8ul << 20);
+	const auto touch = machine.address_of("touch");
+	REQUIRE(touch != 0x0);
+
+	for (const bool keep_all : {false, true})
+	{
+		const tinykvm::MachineOptions options {
+			.max_mem = 16ul << 20, .max_cow_mem = 8ul << 20,
+			.adaptive_hugepage_cow = true,
+			.adaptive_hugepage_threshold = 4,
+			.reset_keep_all_work_memory = keep_all,
+		};
+		tinykvm::Machine fork { machine, options };
+		const auto pages_written_by = [&] (unsigned pages) {
+			const size_t before = fork.banked_memory_pages();
+			fork.timed_vmcall(touch, 4.0f, pages);
+			return fork.banked_memory_pages() - before;
+		};
+
+		// The region is split at first, and only the written pages are cloned
+		REQUIRE(pages_written_by(1) < 512);
+		// Densely written over a few requests, it becomes hot
+		for (unsigned i = 0; i < 4; i++) {
+			pages_written_by(16);
+			fork.reset_to(machine, options);
+		}
+		// After a full reset, a single write now clones the whole 2MB region
+		auto full_reset = options;
+		full_reset.reset_keep_all_work_memory = false;
+		fork.reset_to(machine, full_reset);
+		REQUIRE(pages_written_by(1) >= 512);
+	}
+}
+
+TEST_CASE("Prepare copy-on-write with several threads", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+}
+static int value = 0;
+extern int get_value() {
+	value ++;
+	return value;
+})M");
+
+	tinykvm::Machine machine { binary, {
+		.max_mem = 4ULL << 30,
+		.prepare_threads = 4,
+	} };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+	REQUIRE(machine.prepare_stats().threads == 4);
+	REQUIRE(machine.prepare_stats().total_ns >= machine.prepare_stats().makecow_ns);
+
+	tinykvm::Machine fork { machine, {
+		.max_mem = 4ULL << 30, .max_cow_mem = MAX_COWMEM
+	} };
+	fork.vmcall("get_value");
+	REQUIRE(fork.return_value() == 1);
+}
+
+TEST_CASE("Copy, zero and expose ranges crossing page, 2MB and bank boundaries", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+#include <string.h>
+char buffer[12 << 20] __attribute__((aligned(2 << 20)));
+int main() {
+	memset(buffer, 'M', sizeof(buffer));
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = 64ULL << 20 } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	tinykvm::Machine fork { machine, {
+		.max_mem = 64ULL << 20, .max_cow_mem = 32ULL << 20
+	} };
+	const uint64_t buffer = fork.address_of("buffer");
+	REQUIRE(buffer != 0x0);
+	// Starts and ends inside a page, and spans more than one memory bank
+	const uint64_t addr = buffer + 4096 - 100;
+	const size_t len = 10ULL << 20;
+	std::vector<uint8_t> data(len);
+	for (size_t i = 0; i < len; i++)
+		data[i] = uint8_t(i * 7 + 1);
+	auto guest_bytes = [&] (uint64_t from, size_t n) {
+		std::vector<uint8_t> result(n);
+		fork.copy_from_guest(result.data(), from, n);
+		return result;
+	};
+
+	fork.copy_to_guest(addr, data.data(), len);
+	REQUIRE(guest_bytes(addr, len) == data);
+	REQUIRE(fork.work_memory_stats().banks > 1);
+	REQUIRE(guest_bytes(addr - 1, 1)[0] == 'M');
+	REQUIRE(guest_bytes(addr + len, 1)[0] == 'M');
+
+	// Zero all but 1000 bytes at each end
+	fork.memzero(addr + 1000, len - 2000);
+	auto zeroed = guest_bytes(addr, len);
+	for (size_t i = 0; i < len; i++) {
+		const uint8_t expected = (i < 1000 || i >= len - 1000) ? data[i] : 0;
+		if (zeroed[i] != expected)
+			FAIL("memzero mismatch at offset " << i);
+	}
+
+	// Writable buffers cover the range exactly, in order
+	std::vector<tinykvm::Machine::WrBuffer> buffers;
+	fork.writable_buffers_from_range(buffers, addr, len);
+	size_t total = 0;
+	for (const auto& wbuf : buffers) {
+		std::memset(wbuf.ptr, 'B', wbuf.len);
+		total += wbuf.len;
+	}
+	REQUIRE(total == len);
+	REQUIRE(guest_bytes(addr, len) == std::vector<uint8_t>(len, 'B'));
+	REQUIRE(guest_bytes(addr - 1, 1)[0] == 'M');
+	REQUIRE(guest_bytes(addr + len, 1)[0] == 'M');
+}
+
+TEST_CASE("Merge profiling snapshots from many forks", "[Fork]")
+{
+	const auto binary = build_and_load(R"M(
+extern long write(int, const void*, unsigned long);
+int main() {
+}
+extern void prints_hello_world() {
+	write(1, "Hello World!", 12);
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"fork"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write();
+
+	tinykvm::MachineProfiling::Snapshot total;
+	for (int i = 0; i < 4; i++) {
+		tinykvm::Machine fork { machine, {
+			.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM
+		} };
+		fork.set_printer([] (const char*, size_t) {});
+		fork.set_profiling(true);
+		fork.vmcall("prints_hello_world");
+		total.merge(fork.profiling()->snapshot());
+	}
+	REQUIRE(total.times[tinykvm::MachineProfiling::VCpuRun].samples >= 4);
+	REQUIRE(total.exits[tinykvm::MachineProfiling::ExitSyscall].samples >= 4);
+	// Each fork wrote once, and the write histograms were merged
+	REQUIRE(!total.syscalls.empty());
+	const auto it = std::find_if(total.syscalls.begin(), total.syscalls.end(),
+		[] (const auto& entry) { return entry.first == 1; });
+	REQUIRE(it != total.syscalls.end());
+	REQUIRE(it->second.samples == 4);
+	REQUIRE(it->second.percentile(50.0) <= it->second.max);
+}
@@ -169,3 +169,153 @@ extern void crash(const char *arg) {
 		});
 	}
 }
+
+TEST_CASE("Reset VM with lazily zeroed work memory", "[Reset]")
+{
+	const auto binary = build_and_load(R"M(
+static int a = 0;
+int main() {
+}
+extern long get_a() {
+	int ta = a;
+	a = 333;
+	return ta;
+}
+extern long get_mmap(int *z) {
+	int total = 0;
+	for (int i = 0; i < 64 * 1024; i += 1024) {
+		total += z[i];
+		z[i] = i + 1;
+	}
+	return total;
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"reset"}, env);
+	machine.run(4.0f);
+	machine.prepare_copy_on_write(0);
+
+	auto maddr = machine.mmap_allocate(64 * 4096);
+
+	// Keep everything resident, and then with a 64KB watermark
+	for (const uint32_t free_limit : {0u, 65536u})
+	{
+		const tinykvm::MachineOptions options {
+			.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+			.reset_free_work_mem = free_limit,
+			.reset_lazy_zeroing = true,
+		};
+		auto fork = tinykvm::Machine { machine, options };
+
+		for (size_t i = 0; i < 15; i++)
+		{
+			fork.timed_vmcall(fork.address_of("get_a"), 2.0f);
+			REQUIRE(fork.return_value() == 0);
+
+			// Recycled bank pages must be zeroed again
+			fork.timed_vmcall(fork.address_of("get_mmap"), 2.0f, (uint64_t)maddr);
+			REQUIRE(fork.return_value() == 0);
+
+			fork.reset_to(machine, options);
+		}
+	}
+}
+
+TEST_CASE("Restore dirtied main memory from a checkpoint", "[Reset]")
+{
+	const auto binary = build_and_load(R"M(
+static int a = 0;
+int main() {
+}
+extern long get_a() {
+	int ta = a;
+	a = 333;
+	return ta;
+})M");
+
+	tinykvm::Machine machine { binary, {
+		.max_mem = MAX_MEMORY, .dirty_log_main_memory = true
+	} };
+	machine.setup_linux({"reset"}, env);
+	machine.run(4.0f);
+	machine.dirty_log_checkpoint();
+
+	auto maddr = machine.mmap_allocate(4096);
+	for (size_t i = 0; i < 10; i++)
+	{
+		machine.timed_vmcall(machine.address_of("get_a"), 2.0f);
+		REQUIRE(machine.return_value() == 0);
+
+		// Host writes are logged too
+		const int value = 1234;
+		machine.copy_to_guest(maddr, &value, sizeof(value));
+		REQUIRE(!machine.dirty_log_pages().empty());
+
+		REQUIRE(machine.dirty_log_restore() > 0);
+		int restored = -1;
+		machine.copy_from_guest(&restored, maddr, sizeof(restored));
+		REQUIRE(restored == 0);
+	}
+}
+
+TEST_CASE("Minimal reset only when threads and file descriptors are unused", "[Reset]")
+{
+	const auto binary = build_and_load(R"M(
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+static int clear_tid;
+int main() {
+	printf("Hello World!\n");
+}
+extern long compute(long x) {
+	return x * 2;
+}
+extern long open_pipe() {
+	int fds[2];
+	return pipe2(fds, 0);
+}
+extern long set_clear_tid() {
+	return syscall(SYS_set_tid_address, &clear_tid);
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"reset"}, env);
+	machine.set_printer([] (const char*, size_t) {});
+	machine.run(4.0f);
+	machine.prepare_copy_on_write(0);
+
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY, .max_cow_mem = MAX_COWMEM,
+		.reset_minimal = true,
+	};
+	auto fork = tinykvm::Machine { machine, options };
+	fork.set_printer([] (const char*, size_t) {});
+
+	// libc startup set up the main thread, which stays unchanged,
+	// and printing only used stdio, so the minimal reset applies
+	REQUIRE(machine.has_threads());
+	REQUIRE(fork.has_threads());
+	fork.vmcall("compute", 21);
+	REQUIRE(fork.return_value() == 42);
+	REQUIRE(fork.fds().get_current_fds_opened() == 3);
+	REQUIRE(fork.uses_no_subsystems(machine));
+	fork.reset_to(machine, options);
+
+	// A pipe falls back to the full reset, closing it again
+	fork.vmcall("open_pipe");
+	REQUIRE(fork.return_value() == 0);
+	REQUIRE(fork.fds().get_total_fds_opened() == 2);
+	REQUIRE(!fork.uses_no_subsystems(machine));
+	fork.reset_to(machine, options);
+	REQUIRE(fork.fds().get_total_fds_opened() == 0);
+	REQUIRE(fork.uses_no_subsystems(machine));
+
+	// A changed main thread also falls back to the full reset
+	fork.vmcall("set_clear_tid");
+	REQUIRE(fork.return_value() == 1);
+	REQUIRE(!fork.uses_no_subsystems(machine));
+	fork.reset_to(machine, options);
+	REQUIRE(fork.uses_no_subsystems(machine));
+}
@@ -93,3 +93,79 @@ int main() {
 	for (auto& thread : threads)
 		thread.join();
 }
+
+TEST_CASE("Timeouts enforced by the watchdog", "[Timeout]")
+{
+	const auto good_binary = build_and_load(R"M(
+int main() {
+	return 0;
+})M");
+	const auto bad_binary = build_and_load(R"M(
+int main() {
+	while (1);
+})M");
+	const tinykvm::MachineOptions options {
+		.max_mem = MAX_MEMORY,
+		.timeout_watchdog = true,
+	};
+
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < 20; i++)
+	{
+		threads.push_back(std::thread([&] {
+			tinykvm::Machine machine { good_binary, options };
+			machine.setup_linux({"timeout"}, env);
+			// This must *NOT* cause a timeout exception
+			try {
+				machine.run(1.0f);
+			} catch (const tinykvm::MachineTimeoutException& e) {
+				throw std::runtime_error("Timeout in good program");
+			}
+		}));
+		threads.push_back(std::thread([&] {
+			tinykvm::Machine machine { bad_binary, options };
+			machine.setup_linux({"timeout"}, env);
+			machine.prepare_copy_on_write();
+			// A fork must time out the same way
+			tinykvm::Machine fork { machine, options };
+			for (auto* vm : { &machine, &fork }) {
+				try {
+					vm->run(0.1f);
+					throw std::runtime_error("No timeout");
+				} catch (const tinykvm::MachineTimeoutException& e) {
+				}
+			}
+		}));
+	}
+	for (auto& thread : threads)
+		thread.join();
+}
+
+TEST_CASE("Cancel execution from another thread", "[Timeout]")
+{
+	const auto binary = build_and_load(R"M(
+int main() {
+	while (1);
+})M");
+
+	tinykvm::Machine machine { binary, { .max_mem = MAX_MEMORY } };
+	machine.setup_linux({"timeout"}, env);
+	// Nothing to cancel yet
+	REQUIRE(!machine.request_stop_async());
+
+	std::thread canceller([&] {
+		while (!machine.request_stop_async())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	});
+	// This must be cancelled long before the timeout
+	const auto t0 = std::chrono::steady_clock::now();
+	try {
+		machine.run(10.0f);
+		FAIL("Not cancelled");
+	} catch (const tinykvm::MachineTimeoutException& e) {
+		REQUIRE(e.seconds() == 0.0f);
+	}
+	canceller.join();
+	REQUIRE(std::chrono::steady_clock::now() - t0 < std::chrono::seconds(5));
+}